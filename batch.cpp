@@ -0,0 +1,39 @@
+#include "game.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+// Headless tool for tuning enemies by brute force.
+//
+//   batch [runs] [health] [damage] [range] [ticks] [threads]
+//
+// plays runs games of level1 with random input, every enemy's health,
+// damage and attack range scaled by the given factors, each for at most
+// ticks ticks, and reports how they ended and how fast they ran
+int main(int argc, char* argv[]) {
+    int runs = (argc > 1) ? std::atoi(argv[1]) : 256;
+    EnemyTuning tuning = EnemyTuning{ 1.f, 1.f, 1.f };
+    if (argc > 2) tuning.health = static_cast<float>(std::atof(argv[2]));
+    if (argc > 3) tuning.damage = static_cast<float>(std::atof(argv[3]));
+    if (argc > 4) tuning.attackRange = static_cast<float>(std::atof(argv[4]));
+    int maxTicks = (argc > 5) ? std::atoi(argv[5]) : 60 * 120;
+    unsigned threads = (argc > 6) ? static_cast<unsigned>(std::atoi(argv[6])) : std::max(std::thread::hardware_concurrency(), 1u);
+    if (runs <= 0 || maxTicks <= 0 || threads == 0) {
+        std::cout << "Usage: batch [runs] [health] [damage] [range] [ticks] [threads]" << std::endl;
+        return 1;
+    }
+
+    std::vector<BatchJob> jobs;
+    for (int i = 0; i < runs; i++) {
+        jobs.push_back(BatchJob{ "levels/level1", tuning, {}, static_cast<uint32_t>(i + 1), maxTicks });
+    }
+
+    BatchRunner runner(threads);
+    BatchSummary summary = BatchRunner::summarize(runner.run(jobs));
+    std::cout << summary.runs << " games: " << summary.won << " won, " << summary.died << " died, "
+              << summary.timedOut << " timed out" << std::endl;
+    std::cout << "Average " << summary.averageTicks << " ticks, " << summary.averageDefeated
+              << " enemies defeated, " << summary.averageHealth << " health left" << std::endl;
+    std::cout << runner.getTicks() << " ticks in " << runner.getSeconds() << " s on " << runner.getThreads()
+              << " threads (" << static_cast<long long>(runner.getTicks() / runner.getSeconds()) << " ticks/s)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,780 @@
+#include "game.hpp"
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Benchmarks for the game. Run "bench <name>" for a single benchmark or
+// "bench" for all of them.
+
+static double averageMilliseconds(int frames, const std::function<void()>& frame)
+{
+    frame();  // warm up
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) frame();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / frames;
+}
+
+// Counts heap allocations made by the thread that turned counting on
+static thread_local bool countAllocations = false;
+static long long allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    if (countAllocations) allocations++;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+// GCC sees these free() what its own operator new returned and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Menu frame the way Game::render used to draw it: a fresh font and fresh
+// text every frame
+static void drawMenuLegacy(sf::RenderTarget& target)
+{
+    sf::Font font;
+    font.loadFromFile("arial.ttf");
+
+    sf::Text option1("Start Game", font, 32);
+    sf::Text option2("Quit Game", font, 32);
+    option1.setPosition(700, 400);
+    option2.setPosition(705, 470);
+
+    sf::FloatRect bounds = option1.getGlobalBounds();
+    sf::RectangleShape box(sf::Vector2f(bounds.width + 20, bounds.height + 10));
+    box.setPosition(bounds.left - 10, bounds.top - 5);
+    box.setFillColor(sf::Color::Transparent);
+    box.setOutlineThickness(2);
+
+    target.clear();
+    target.draw(option1);
+    target.draw(option2);
+    target.draw(box);
+}
+
+static int benchFont()
+{
+    sf::RenderTexture target;
+    if (!target.create(1600, 900)) {
+        std::cout << "font: no render target available, skipped" << std::endl;
+        return 0;
+    }
+
+    const int frames = 600;
+    double legacy = averageMilliseconds(frames, [&]() { drawMenuLegacy(target); });
+
+    // Same frame with the shared font and pre-built text Game now uses
+    std::shared_ptr<sf::Font> font = AssetManager::getFont("arial.ttf");
+    sf::Text option1("Start Game", *font, 32);
+    sf::Text option2("Quit Game", *font, 32);
+    option1.setPosition(700, 400);
+    option2.setPosition(705, 470);
+    sf::FloatRect bounds = option1.getGlobalBounds();
+    sf::RectangleShape box(sf::Vector2f(bounds.width + 20, bounds.height + 10));
+    box.setPosition(bounds.left - 10, bounds.top - 5);
+    box.setFillColor(sf::Color::Transparent);
+    box.setOutlineThickness(2);
+
+    double cached = averageMilliseconds(frames, [&]() {
+        target.clear();
+        target.draw(option1);
+        target.draw(option2);
+        target.draw(box);
+    });
+
+    std::cout << "font: menu frame " << legacy << " ms per-frame load, "
+              << cached << " ms cached (" << legacy / cached << "x)" << std::endl;
+    return 0;
+}
+
+// A few minutes of play: start from the menu, walk right jumping and
+// attacking, back off now and then, and go back to the menu at the end
+static std::vector<unsigned> playScript()
+{
+    std::vector<unsigned> script;
+    script.push_back(KeyEnter);
+    script.push_back(0);
+
+    for (int i = 0; i < 3600; i++) {
+        unsigned keys = (i % 600 < 480) ? KeyRight : KeyLeft;
+        if (i % 45 < 5) keys |= KeyJump;
+        if (i % 20 == 0) keys |= KeyAttack;
+        if (i % 300 == 0) keys |= KeyHeal;
+        script.push_back(keys);
+    }
+
+    // Enter returns to the menu from the game over screen; harmless otherwise
+    script.push_back(KeyEnter);
+    script.push_back(0);
+    return script;
+}
+
+static int benchTicks()
+{
+    Game game(true);
+    ScriptedInput script(playScript());
+    game.setInput(&script);
+
+    const int ticks = 200000;
+    const float dt = 1.0f / 60.0f;
+    std::vector<double> latencies(ticks);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ticks; i++) {
+        std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+        game.tick(dt);
+        latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - before).count();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "ticks: " << static_cast<long long>(ticks / elapsed.count()) << " ticks/s, "
+              << "p50 " << latencies[ticks / 2] << " us, "
+              << "p99 " << latencies[ticks * 99 / 100] << " us, "
+              << "p99.9 " << latencies[ticks * 999 / 1000] << " us, "
+              << "max " << latencies[ticks - 1] << " us" << std::endl;
+    return 0;
+}
+
+// Hash of the scripted run below with fixed-point movement, recorded when
+// enemies moved to fixed point. Any build, at any optimisation level, has
+// to reproduce it; a change that moves anyone on purpose records a new one.
+static const uint64_t goldenHash = 0x0ebc7a69ae38d13cull;
+
+// Plays the script deterministically and folds the state hash of every tick
+// into one, so the first diverging tick anywhere in the run changes it
+static int benchGolden()
+{
+    Game game(true);
+    game.setDeterministic(true);
+    ScriptedInput script(playScript());
+    game.setInput(&script);
+
+    const int ticks = 36000;
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < ticks; i++) {
+        game.tick(1.0f / 60.0f);
+        hash = (hash ^ game.stateHash()) * 1099511628211ull;
+    }
+
+    char hex[32];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    if (hash != goldenHash) {
+        std::cout << "golden: FAILED, " << ticks << " ticks hashed to " << hex << std::endl;
+        return 1;
+    }
+    std::cout << "golden: " << ticks << " ticks match " << hex << std::endl;
+    return 0;
+}
+
+// Fills a pool with count enemies spread over a long level, patrolling in
+// pairs of overlapping ranges so some chase and attack the player
+static void fillPool(EnemyPool& pool, int count)
+{
+    const char* kinds[] = { "enemy2", "deephunter", "shadowcreeper", "mosscharger" };
+    for (int i = 0; i < count; i++) {
+        float left = (i / 2) * 150.f;
+        EnemySpawn spawn = { left + 50.f, 725.f, left, left + 300.f, "", 0.75f, 50, 15, 30.f };
+        std::strncpy(spawn.frame, kinds[i % 4], sizeof(spawn.frame) - 1);
+        pool.spawn(spawn);
+    }
+}
+
+static int benchEnemies()
+{
+    AssetManager::setHeadless(true);
+    Player player;
+
+    const int counts[] = { 10000, 100000 };
+    double rates[2];
+    for (int c = 0; c < 2; c++) {
+        EnemyPool pool;
+        fillPool(pool, counts[c]);
+
+        const int ticks = 10000000 / counts[c];
+        double ms = averageMilliseconds(ticks, [&]() {
+            player.health = 100;
+            pool.update(1.0f / 60.0f, player);
+        });
+        rates[c] = counts[c] / ms * 1000.0;
+    }
+
+    for (int c = 0; c < 2; c++) {
+        std::cout << "enemies: " << counts[c] << " enemies, "
+                  << static_cast<long long>(rates[c]) << " enemy updates/s" << std::endl;
+    }
+
+    // The same large pool with only a tenth of the level awake, the way the
+    // game keeps enemies near the camera awake and lets the rest sleep
+    EnemyPool pool;
+    fillPool(pool, counts[1]);
+    float levelWidth = counts[1] / 2 * 150.f;
+    sf::FloatRect awake(levelWidth * 0.45f, 0.f, levelWidth * 0.1f, 2000.f);
+    const int ticks = 10000000 / counts[1];
+    double ms = averageMilliseconds(ticks, [&]() {
+        player.health = 100;
+        pool.update(1.0f / 60.0f, player, &awake, Game::dormantInterval);
+    });
+    std::cout << "enemies: " << counts[1] << " enemies, a tenth awake, "
+              << static_cast<long long>(counts[1] / ms * 1000.0) << " enemy updates/s" << std::endl;
+    return 0;
+}
+
+template <typename T>
+static bool sameBits(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+static bool samePools(const EnemyPool& a, const EnemyPool& b)
+{
+    return sameBits(a.x, b.x) && sameBits(a.y, b.y) && sameBits(a.vx, b.vx)
+        && sameBits(a.attackTimer, b.attackTimer) && sameBits(a.colorTimer, b.colorTimer)
+        && sameBits(a.despawnTimer, b.despawnTimer) && sameBits(a.health, b.health)
+        && sameBits(a.isDead, b.isDead) && sameBits(a.facingRight, b.facingRight)
+        && sameBits(a.isAttacking, b.isAttacking);
+}
+
+// Checks the batch enemy kernel against the scalar one tick by tick, then
+// times both
+static int benchBatch()
+{
+    AssetManager::setHeadless(true);
+    Player scalarTarget;
+    Player batchTarget;
+
+    const int count = 10003;  // not a multiple of the batch width
+    EnemyPool scalar;
+    EnemyPool batch;
+    fillPool(scalar, count);
+    fillPool(batch, count);
+    scalar.useBatch = false;
+    for (int i = 0; i < count; i += 7) {
+        scalar.isDead[i] = batch.isDead[i] = true;
+    }
+
+    int mismatch = -1;
+    for (int tick = 0; tick < 2000 && mismatch < 0; tick++) {
+        // Sweep the player back and forth so enemies chase, patrol and attack
+        float px = std::fabs(std::fmod(tick * 37.5f, 2.f * count * 75.f) - count * 75.f);
+        float py = 645.f + (tick % 3);
+        scalarTarget.setPosition(px, py);
+        batchTarget.setPosition(px, py);
+        scalarTarget.health = batchTarget.health = 100;
+
+        scalar.update(1.0f / 60.0f, scalarTarget);
+        batch.update(1.0f / 60.0f, batchTarget);
+        if (!samePools(scalar, batch)) mismatch = tick;
+    }
+
+    double scalarMs = averageMilliseconds(2000, [&]() { scalar.update(1.0f / 60.0f, scalarTarget); });
+    double batchMs = averageMilliseconds(2000, [&]() { batch.update(1.0f / 60.0f, batchTarget); });
+
+    if (mismatch >= 0) {
+        std::cout << "batch: FAILED, batch and scalar enemy updates differ at tick " << mismatch << std::endl;
+        return 1;
+    }
+    std::cout << "batch: bit-identical to scalar, " << count << " enemies "
+              << scalarMs << " ms scalar, " << batchMs << " ms batch" << std::endl;
+    return 0;
+}
+
+// Drives a headless game through the fixed stepper with injected stalls and
+// checks that catch-up stays bounded and every second is accounted for
+static int benchStall()
+{
+    int failures = 0;
+
+    Game game(true);
+    ScriptedInput script(playScript());
+    game.setInput(&script);
+    const FixedStepper& stepper = game.getStepper();
+
+    const int frames = 6000;
+    double elapsedTotal = 0.0;
+    long long ticks = 0;
+    int longest = 0;
+    for (int i = 0; i < frames; i++) {
+        // A 60 Hz frame, with a half-second stall every 500 frames
+        float elapsed = (i % 500 == 499) ? 0.5f : 1.0f / 60.0f;
+        elapsedTotal += elapsed;
+        int steps = game.advance(elapsed);
+        ticks += steps;
+        longest = std::max(longest, steps);
+    }
+
+    double accounted = ticks * stepper.getStep() + stepper.getDebt() + stepper.getRemainder();
+    if (longest > 5) {
+        std::cout << "stall: FAILED, one frame ran " << longest << " ticks" << std::endl;
+        failures++;
+    }
+    if (std::fabs(accounted - elapsedTotal) > 0.01) {
+        std::cout << "stall: FAILED, " << elapsedTotal << " s elapsed but " << accounted << " s accounted for" << std::endl;
+        failures++;
+    }
+    if (stepper.getDebt() < 11 * 0.4f) {
+        std::cout << "stall: FAILED, only " << stepper.getDebt() << " s of debt after 12 stalls" << std::endl;
+        failures++;
+    }
+
+    // Slow ticks degrade the stepper, fast ones bring it back
+    FixedStepper budgeted(1.0f / 60.0f);
+    budgeted.setDegradable(true);
+    for (int i = 0; i < 50; i++) budgeted.recordTick(0.012f);
+    budgeted.advance(1.0f / 60.0f);
+    bool slowDegraded = budgeted.isDegraded();
+    for (int i = 0; i < 50; i++) budgeted.recordTick(0.001f);
+    budgeted.advance(1.0f / 60.0f);
+    bool fastDegraded = budgeted.isDegraded();
+    budgeted.setDegradable(false);
+    budgeted.advance(1.0f);
+    if (!slowDegraded || fastDegraded || budgeted.isDegraded()) {
+        std::cout << "stall: FAILED, degraded mode does not follow the tick budget" << std::endl;
+        failures++;
+    }
+
+    // Degraded enemies only think inside the active area. One that walks
+    // out of it stops there, so where each enemy started decides.
+    Player target;
+    target.setPosition(0.f, 645.f);
+    EnemyPool pool;
+    fillPool(pool, 400);
+    std::vector<Fixed> before = pool.x;
+    sf::FloatRect active(-1000.f, 0.f, 3000.f, 2000.f);
+    for (int i = 0; i < 60; i++) pool.update(1.0f / 60.0f, target, &active);
+    int wrong = 0;
+    for (int i = 0; i < pool.size(); i++) {
+        bool moved = pool.x[i] != before[i];
+        sf::FloatRect start(before[i].toFloat(), pool.y[i].toFloat(), pool.width[i], pool.height[i]);
+        if (moved != active.intersects(start)) wrong++;
+    }
+    if (wrong > 0) {
+        std::cout << "stall: FAILED, " << wrong << " enemies ignored the active area" << std::endl;
+        failures++;
+    }
+
+    if (failures == 0) {
+        std::cout << "stall: " << ticks << " ticks over " << elapsedTotal << " s, at most " << longest
+                  << " per frame, " << stepper.getDebt() << " s dropped" << std::endl;
+    }
+    return failures;
+}
+
+// Records a headless run with profiling on, checks the Chrome trace it
+// writes and compares tick cost with profiling off and on
+static int benchTrace()
+{
+    Game game(true);
+    ScriptedInput script(playScript());
+    game.setInput(&script);
+
+    const float dt = 1.0f / 60.0f;
+    double offMs = averageMilliseconds(3000, [&]() { game.tick(dt); });
+    Profiler::instance().setEnabled(true);
+    double onMs = averageMilliseconds(3000, [&]() { game.tick(dt); });
+    Profiler::instance().setEnabled(false);
+
+    const char* filename = "bench_trace.json";
+    if (!Profiler::instance().writeTrace(filename)) {
+        std::cout << "trace: FAILED, could not write " << filename << std::endl;
+        return 1;
+    }
+    std::ifstream file(filename);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::remove(filename);
+
+    std::string json = contents.str();
+    int events = 0;
+    for (size_t at = json.find("\"ph\":\"X\""); at != std::string::npos; at = json.find("\"ph\":\"X\"", at + 1)) events++;
+
+    const char* zones[] = { "Game::update", "Player::update", "EnemyPool::update", "camera" };
+    for (const char* zone : zones) {
+        if (json.find(std::string("\"name\":\"") + zone + "\"") == std::string::npos) {
+            std::cout << "trace: FAILED, no " << zone << " zone in the trace" << std::endl;
+            return 1;
+        }
+    }
+    if (json.compare(0, 16, "{\"traceEvents\":[") != 0 || json.find("]}") == std::string::npos) {
+        std::cout << "trace: FAILED, not a trace_event document" << std::endl;
+        return 1;
+    }
+
+    std::cout << "trace: " << events << " events, " << offMs * 1000.0 << " us per tick unprofiled, "
+              << onMs * 1000.0 << " us profiled" << std::endl;
+    return 0;
+}
+
+// Plays the scripted game headless and fails if a tick plus the CPU side of
+// its frame allocates once the game has been through the script once
+static int benchAlloc()
+{
+    Game game(true);
+    ScriptedInput script(playScript());
+    game.setInput(&script);
+
+    // One pass through the script reaches every batch size and HUD value
+    // the measured frames will see
+    const float dt = 1.0f / 60.0f;
+    for (size_t i = 0; i < playScript().size(); i++) {
+        game.tick(dt);
+        game.buildFrame();
+    }
+
+    // Headless games time no frames, so the F3 graph is fed directly with
+    // times that move its worst-frame label on most frames
+    FrameTimeGraph graph;
+    graph.update();
+
+    const int frames = 3000;
+    allocations = 0;
+    countAllocations = true;
+    for (int i = 0; i < frames; i++) {
+        game.tick(dt);
+        game.buildFrame();
+        graph.record((i % 500) * 0.1f);
+        graph.update();
+    }
+    countAllocations = false;
+
+    if (allocations > 0) {
+        std::cout << "alloc: FAILED, " << allocations << " heap allocations in " << frames << " steady-state frames" << std::endl;
+        return 1;
+    }
+    std::cout << "alloc: no heap allocations in " << frames << " steady-state frames" << std::endl;
+    return 0;
+}
+
+// Decodes the images a windowed game starts with, first on one thread and
+// then on every core, and checks both produce the same images
+static int benchStartup()
+{
+    AssetManager::setHeadless(false);
+    std::vector<std::string> files = AssetManager::startupFiles();
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::shared_ptr<sf::Image>> serial, parallel;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    serial = AssetManager::preload(files, 1);
+    std::chrono::duration<double, std::milli> serialMs = std::chrono::steady_clock::now() - start;
+    serial.clear();  // drops them from the cache so they are decoded again
+
+    start = std::chrono::steady_clock::now();
+    parallel = AssetManager::preload(files, cores);
+    std::chrono::duration<double, std::milli> parallelMs = std::chrono::steady_clock::now() - start;
+
+    serial = AssetManager::preload(files, 1);  // cached, for comparing
+    for (size_t i = 0; i < files.size(); i++) {
+        if (parallel[i]->getSize() != serial[i]->getSize()) {
+            std::cout << "startup: FAILED, " << files[i] << " decoded differently in parallel" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "startup: " << files.size() << " images, " << serialMs.count() << " ms on 1 thread, "
+              << parallelMs.count() << " ms on " << cores << " (" << serialMs.count() / parallelMs.count() << "x)" << std::endl;
+    return 0;
+}
+
+// Runs right through a level fifty times longer than level 1 and checks the
+// work per frame stays flat because only the chunks near the camera load
+static int benchChunks()
+{
+    const float length = 200000.f;
+    const char* name = "bench_long";
+    {
+        std::ofstream file(std::string(name) + ".txt");
+        file << "world 0 " << length << "\n";
+        for (float x = 0.f; x < length; x += 300.f) file << "platform platform " << x << " 600\n";
+        // Harmless enemies, so the run never ends early
+        for (float x = 1000.f; x < length; x += 1000.f)
+            file << "enemy enemy2 " << x << " 500 " << x - 150.f << " " << x + 150.f << " 0.75 100 0 30\n";
+    }
+
+    Game game(true, name);
+    std::remove((std::string(name) + ".txt").c_str());
+    const float dt = 1.0f / 60.0f;
+    const int ticks = 40000;
+    std::vector<unsigned> script;
+    script.push_back(KeyEnter);
+    script.push_back(0);
+    script.resize(ticks, KeyRight);
+    ScriptedInput input(script, false);
+    game.setInput(&input);
+
+    int mostLoaded = 0;
+    double firstMs = 0.0, lastMs = 0.0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ticks; i++) {
+        game.tick(dt);
+        game.buildFrame();
+
+        const RenderStats& stats = game.getRenderStats();
+        mostLoaded = std::max(mostLoaded, stats.submitted + stats.culled);
+        if (i == ticks / 10 || i == ticks - 1) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            (i == ticks / 10 ? firstMs : lastMs) = ms;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    float reached = game.getPlayerPosition().x;
+    if (reached < length / 2.f) {
+        std::cout << "chunks: FAILED, the player only got to x = " << reached << std::endl;
+        return 1;
+    }
+    if (mostLoaded > 64) {
+        std::cout << "chunks: FAILED, " << mostLoaded << " objects loaded at once" << std::endl;
+        return 1;
+    }
+
+    double firstRate = firstMs / (ticks / 10 + 1);
+    double lastRate = lastMs / (ticks - ticks / 10 - 1);
+    std::cout << "chunks: reached x = " << reached << ", at most " << mostLoaded << " objects loaded, "
+              << firstRate * 1000.0 << " us per frame early, " << lastRate * 1000.0 << " us late" << std::endl;
+    return 0;
+}
+
+// Records the scripted run, replays the file in a fresh game and checks
+// every tick's state matches, then reports how small the file is and how
+// fast it replays
+static int benchReplay()
+{
+    const char* file = "bench_replay.inp";
+    const int ticks = 36000;
+    std::vector<uint64_t> recorded(ticks);
+    {
+        Game game(true);
+        ScriptedInput script(playScript());
+        InputRecorder recorder("levels/level1");
+        game.setInput(&script);
+        game.setRecorder(&recorder);
+        for (int i = 0; i < ticks; i++) {
+            game.tick(Game::tickLength);
+            recorded[i] = game.stateHash();
+        }
+        if (!recorder.save(file, game.getViewSize())) return 1;
+    }
+
+    ReplayInput input;
+    bool loaded = input.load(file);
+    std::ifstream sizeCheck(file, std::ios::binary | std::ios::ate);
+    long long bytes = sizeCheck.tellg();
+    sizeCheck.close();
+    std::remove(file);
+    if (!loaded) return 1;
+
+    Game game(true, input.getLevel());
+    game.setViewSize(input.getViewSize());
+    game.setDeterministic(true);
+    game.setInput(&input);
+
+    int mismatch = -1;
+    int replayed = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (!input.finished()) {
+        game.tick(Game::tickLength);
+        if (mismatch < 0 && (replayed >= ticks || game.stateHash() != recorded[replayed])) mismatch = replayed;
+        replayed++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (replayed != ticks || mismatch >= 0) {
+        std::cout << "replay: FAILED, " << replayed << " of " << ticks << " ticks replayed, first mismatch at "
+                  << mismatch << std::endl;
+        return 1;
+    }
+    std::cout << "replay: " << ticks << " ticks in " << bytes << " bytes (" << ticks * 2 << " raw), replayed at "
+              << static_cast<long long>(ticks / elapsed.count()) << " ticks/s" << std::endl;
+    return 0;
+}
+
+// Saves the game partway through the script, plays on, rolls back and
+// plays the same input again, checking every tick's snapshot matches byte
+// for byte; then times a save and a restore
+static int benchSnapshot()
+{
+    std::vector<unsigned> script = playScript();
+    const int before = 1000;
+    const int after = 600;
+    std::vector<unsigned> lead(script.begin(), script.begin() + before);
+    std::vector<unsigned> rest(script.begin() + before, script.begin() + before + after);
+
+    Game game(true);
+    ScriptedInput leadInput(lead, false);
+    game.setInput(&leadInput);
+    for (int i = 0; i < before; i++) game.tick(Game::tickLength);
+
+    std::vector<unsigned char> snapshot;
+    game.saveState(snapshot);
+
+    std::vector<std::vector<unsigned char>> states(after);
+    ScriptedInput firstInput(rest, false);
+    game.setInput(&firstInput);
+    for (int i = 0; i < after; i++) {
+        game.tick(Game::tickLength);
+        game.saveState(states[i]);
+    }
+
+    if (!game.restoreState(snapshot)) {
+        std::cout << "snapshot: FAILED, the game refused its own snapshot" << std::endl;
+        return 1;
+    }
+    int mismatch = -1;
+    std::vector<unsigned char> buffer;
+    ScriptedInput secondInput(rest, false);
+    game.setInput(&secondInput);
+    for (int i = 0; i < after && mismatch < 0; i++) {
+        game.tick(Game::tickLength);
+        game.saveState(buffer);
+        if (buffer != states[i]) mismatch = i;
+    }
+    if (mismatch >= 0) {
+        std::cout << "snapshot: FAILED, the rolled back game differs " << mismatch << " ticks later" << std::endl;
+        return 1;
+    }
+
+    // Cut short or padded snapshots are refused and leave the game alone
+    std::vector<unsigned char> current;
+    game.saveState(current);
+    for (size_t length = 0; length <= snapshot.size() + 1; length++) {
+        if (length == snapshot.size()) continue;
+        std::vector<unsigned char> damaged(snapshot.begin(), snapshot.begin() + std::min(length, snapshot.size()));
+        damaged.resize(length, 0);
+        bool accepted = game.restoreState(damaged);
+        game.saveState(buffer);
+        if (accepted || buffer != current) {
+            std::cout << "snapshot: FAILED, a " << length << " byte snapshot was not refused cleanly" << std::endl;
+            return 1;
+        }
+    }
+
+    // A menu state or option out of range is refused outright
+    const size_t fields[] = { offsetof(GameState, state), offsetof(GameState, option) };
+    for (size_t field : fields) {
+        std::vector<unsigned char> damaged = snapshot;
+        int32_t bad = 7;
+        std::memcpy(&damaged[field], &bad, sizeof(bad));
+        bool accepted = game.restoreState(damaged);
+        game.saveState(buffer);
+        if (accepted || buffer != current) {
+            std::cout << "snapshot: FAILED, an out of range menu field was not refused cleanly" << std::endl;
+            return 1;
+        }
+    }
+
+    // Every word of the enemy part, ids and kinds among them, is set to a
+    // value no table holds; whatever is accepted still has to play and draw
+    int refused = 0;
+    for (size_t offset = sizeof(GameState); offset + 4 <= snapshot.size(); offset += 4) {
+        const int32_t badValues[] = { -1, 1 << 20 };
+        for (int32_t bad : badValues) {
+            std::vector<unsigned char> damaged = snapshot;
+            std::memcpy(&damaged[offset], &bad, sizeof(bad));
+            if (!game.restoreState(damaged)) {
+                refused++;
+                continue;
+            }
+            for (int i = 0; i < 60; i++) {
+                game.tick(Game::tickLength);
+                game.buildFrame();
+            }
+        }
+    }
+    game.restoreState(current);
+
+    double saveMs = averageMilliseconds(10000, [&]() { game.saveState(buffer); });
+    double restoreMs = averageMilliseconds(10000, [&]() { game.restoreState(snapshot); });
+    std::cout << "snapshot: " << after << " ticks identical after rollback, " << refused << " corrupted snapshots refused, " << snapshot.size() << " bytes, "
+              << saveMs * 1000.0 << " us save, " << restoreMs * 1000.0 << " us restore" << std::endl;
+    return 0;
+}
+
+// The same random games on one worker and on every core must end alike,
+// and the cores should share the work out evenly
+static int benchRunner()
+{
+    std::vector<BatchJob> jobs;
+    for (uint32_t seed = 1; seed <= 32; seed++) {
+        jobs.push_back(BatchJob{ "levels/level1", EnemyTuning{ 1.f, 1.f, 1.f }, {}, seed, 3000 });
+    }
+
+    BatchRunner single(1);
+    std::vector<BatchResult> expected = single.run(jobs);
+    BatchRunner all(std::max(2u, std::thread::hardware_concurrency()));
+    std::vector<BatchResult> results = all.run(jobs);
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (std::memcmp(&results[i], &expected[i], sizeof(BatchResult)) != 0) {
+            std::cout << "runner: FAILED, game " << i << " ended differently on " << all.getThreads() << " threads" << std::endl;
+            return 1;
+        }
+    }
+    // A batch run inside a windowed program must hand it back its mode
+    bool wasHeadless = AssetManager::isHeadless();
+    AssetManager::setHeadless(!wasHeadless);
+    BatchRunner(1).run(std::vector<BatchJob>(jobs.begin(), jobs.begin() + 1));
+    bool restored = AssetManager::isHeadless() == !wasHeadless;
+    AssetManager::setHeadless(wasHeadless);
+    if (!restored) {
+        std::cout << "runner: FAILED, the batch left headless mode changed" << std::endl;
+        return 1;
+    }
+    BatchSummary summary = BatchRunner::summarize(results);
+    std::cout << "runner: " << jobs.size() << " games, " << summary.won << " won, " << summary.died << " died, "
+              << summary.timedOut << " timed out; 1 thread " << static_cast<long long>(single.getTicks() / single.getSeconds())
+              << " ticks/s, " << all.getThreads() << " threads " << static_cast<long long>(all.getTicks() / all.getSeconds())
+              << " ticks/s (" << single.getSeconds() / all.getSeconds() << "x)" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string name = (argc > 1) ? argv[1] : "all";
+
+    // The simulation logs every hit; keep that out of the output
+    Logger::instance().setLevel(LogWarning);
+    int failures = 0;
+
+    if (name == "all" || name == "font") failures += benchFont();
+    if (name == "all" || name == "ticks") failures += benchTicks();
+    if (name == "all" || name == "golden") failures += benchGolden();
+    if (name == "all" || name == "replay") failures += benchReplay();
+    if (name == "all" || name == "snapshot") failures += benchSnapshot();
+    if (name == "all" || name == "runner") failures += benchRunner();
+    if (name == "all" || name == "enemies") failures += benchEnemies();
+    if (name == "all" || name == "batch") failures += benchBatch();
+    if (name == "all" || name == "stall") failures += benchStall();
+    if (name == "all" || name == "trace") failures += benchTrace();
+    if (name == "all" || name == "alloc") failures += benchAlloc();
+    if (name == "all" || name == "startup") failures += benchStartup();
+    if (name == "all" || name == "chunks") failures += benchChunks();
+
+    return failures == 0 ? 0 : 1;
+}
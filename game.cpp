@@ -1,38 +1,990 @@
 #include "game.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <cstdarg>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// The AssetManager class, which hands out shared textures so identical sprites
+// do not decode and upload the same PNG again
+std::map<std::string, std::weak_ptr<sf::Texture>> AssetManager::textures;
+std::map<std::string, std::weak_ptr<sf::Image>> AssetManager::images;
+std::map<std::string, std::weak_ptr<sf::Font>> AssetManager::fonts;
+std::map<std::string, sf::IntRect> AssetManager::atlasFrames;
+bool AssetManager::atlasIndexLoaded = false;
+bool AssetManager::headless = false;
+const std::string AssetManager::atlasFile = "PNGS/atlas.bin";
+std::vector<std::unique_ptr<AssetManager::StreamedImage>> AssetManager::streams;
+std::vector<AssetManager::PendingUpload> AssetManager::pendingUploads;
+std::unique_ptr<ThreadPool> AssetManager::streamPool;
+
+// Every frame the game draws and the sheet it is cut from. An empty rect
+// means the whole image. The packer bakes exactly this list into the atlas.
+struct AtlasSource {
+    const char* name;
+    const char* filename;
+    sf::IntRect rect;
+};
+
+static const AtlasSource atlasSources[] = {
+    { "player",        "PNGS/player.png",        sf::IntRect(4025, 3965, 71, 130) },
+    { "player_attack", "PNGS/player.png",        sf::IntRect(1770, 2777, 108, 43) },
+    { "platform",      "PNGS/platform.png",      sf::IntRect(0, 330, 310, 160) },
+    { "title",         "PNGS/title.png",         sf::IntRect(0, 0, 1328, 275) },
+    { "enemy2",        "PNGS/enemy2.png",        sf::IntRect() },
+    { "deephunter",    "PNGS/Deephunter.png",    sf::IntRect() },
+    { "shadowcreeper", "PNGS/shadowcreeper.png", sf::IntRect() },
+    { "mosscharger",   "PNGS/mosscharger.png",   sf::IntRect() },
+    { "fullhealth",    "PNGS/fullhealth.png",    sf::IntRect() },
+    { "nohealth",      "PNGS/nohealth.png",      sf::IntRect() },
+    { "soulorb",       "PNGS/soulorb.png",       sf::IntRect() },
+};
+
+// The Logger class, which keeps console output off the game loop
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : head(0), tail(0), dropped(0), minimum(LogInfo), running(true) {
+    worker = std::thread(&Logger::drain, this);
+}
+
+Logger::~Logger() {
+    running = false;
+    worker.join();
+}
+
+void Logger::setLevel(LogLevel level) {
+    minimum = level;
+}
+
+LogLevel Logger::getLevel() const {
+    return static_cast<LogLevel>(minimum.load());
+}
+
+void Logger::log(LogLevel level, const char* format, ...) {
+    // LogNone is a threshold, not a level, and has no prefix to write
+    if (level < minimum || level >= LogNone) return;
+
+    uint32_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) >= capacity) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Entry& entry = entries[position % capacity];
+    entry.level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(entry.text, sizeof(entry.text), format, args);
+    va_end(args);
+
+    head.store(position + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+    while (tail.load(std::memory_order_acquire) != head.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void Logger::drain() {
+    static const char* prefixes[] = { "[debug] ", "", "[warning] ", "[error] " };
+
+    while (true) {
+        uint32_t position = tail.load(std::memory_order_relaxed);
+        if (position == head.load(std::memory_order_acquire)) {
+            // Only stop once everything logged before shutdown is written
+            if (!running) break;
+            std::cout.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+
+        const Entry& entry = entries[position % capacity];
+        std::cout << prefixes[entry.level] << entry.text << '\n';
+        tail.store(position + 1, std::memory_order_release);
+
+        uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0) std::cout << "[warning] " << lost << " log messages dropped\n";
+    }
+    std::cout.flush();
+}
+
+// The Profiler class, which collects timing zones from every thread
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() : origin(std::chrono::steady_clock::now()), enabled(false) {}
+
+void Profiler::setEnabled(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool Profiler::isEnabled() const {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Profiler::nameThread(const char* name) {
+    buffer().name = name;
+}
+
+int64_t Profiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+Profiler::ThreadBuffer& Profiler::buffer() {
+    // Each thread finds its buffer once; after that recording takes no lock
+    thread_local ThreadBuffer* local = nullptr;
+    if (!local) {
+        std::lock_guard<std::mutex> guard(lock);
+        buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+        local = buffers.back().get();
+        local->id = buffers.size();
+        local->name = nullptr;
+        local->count = 0;
+    }
+    return *local;
+}
+
+void Profiler::record(const char* name, int64_t start, int64_t end) {
+    // A full ring keeps the newest events
+    ThreadBuffer& local = buffer();
+    Event& event = local.events[local.count % capacity];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    local.count++;
+}
+
+bool Profiler::writeTrace(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file) {
+        std::cout << "Failed to write trace: " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& thread : buffers) {
+        if (thread->name) {
+            file << (first ? "" : ",\n")
+                 << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+                 << ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+            first = false;
+        }
+
+        uint32_t begin = thread->count > capacity ? thread->count - capacity : 0;
+        for (uint32_t i = begin; i < thread->count; i++) {
+            const Event& event = thread->events[i % capacity];
+            file << (first ? "" : ",\n")
+                 << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                 << ",\"ts\":" << event.start / 1000.0
+                 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
+
+ProfileZone::ProfileZone(const char* name) : name(name), start(-1) {
+    Profiler& profiler = Profiler::instance();
+    if (profiler.isEnabled()) start = profiler.now();
+}
+
+ProfileZone::~ProfileZone() {
+    if (start < 0) return;
+    Profiler& profiler = Profiler::instance();
+    profiler.record(name, start, profiler.now());
+}
+
+// The ThreadPool class, which runs jobs on a fixed set of worker threads
+ThreadPool::ThreadPool(unsigned threads) : pending(0), stopping(false) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(std::move(job));
+        pending++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]() { return pending == 0; });
+}
+
+unsigned ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0) idle.notify_all();
+    }
+}
+
+// Input sources for the simulation
+KeyboardInput::KeyboardInput() : keys(0) {}
+
+void KeyboardInput::refresh() {
+    unsigned keys = 0;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) keys |= KeyLeft;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::D)) keys |= KeyRight;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::W)) keys |= KeyJump;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q)) keys |= KeyHeal;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::M)) keys |= KeyAttack;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) keys |= KeyUp;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) keys |= KeyDown;
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Enter)) keys |= KeyEnter;
+    this->keys.store(keys, std::memory_order_relaxed);
+}
+
+unsigned KeyboardInput::poll() {
+    return keys.load(std::memory_order_relaxed);
+}
+
+ScriptedInput::ScriptedInput(const std::vector<unsigned>& script, bool loop)
+    : script(script), position(0), loop(loop) {}
+
+unsigned ScriptedInput::poll() {
+    if (script.empty()) return 0;
+    if (position >= script.size()) {
+        if (!loop) return 0;
+        position = 0;
+    }
+    return script[position++];
+}
+
+bool ScriptedInput::finished() const {
+    return !loop && position >= script.size();
+}
+
+// The RandomInput class, which mashes keys from a seed
+RandomInput::RandomInput(uint32_t seed) : random(seed), keys(0), remaining(0), ticks(0) {}
+
+unsigned RandomInput::poll() {
+    // Enter goes down and back up so the game starts
+    if (ticks < 2) return ticks++ == 0 ? KeyEnter : 0;
+    if (remaining == 0) {
+        keys = random() & (KeyLeft | KeyRight | KeyJump | KeyHeal | KeyAttack);
+        if ((keys & (KeyLeft | KeyRight)) == (KeyLeft | KeyRight)) keys &= ~KeyLeft;
+        remaining = 1 + static_cast<int>(random() % 60);
+    }
+    remaining--;
+    return keys;
+}
+
+// The InputRecorder class, which collects input for a replay file
+InputRecorder::InputRecorder(const std::string& level) : level(level), ticks(0) {}
+
+void InputRecorder::record(unsigned keys, unsigned pressed) {
+    uint16_t packed = static_cast<uint16_t>((keys & 0xff) | (pressed & 0xff) << 8);
+    if (!runs.empty() && runs.back().keys == packed && runs.back().ticks < UINT16_MAX) {
+        runs.back().ticks++;
+    } else {
+        runs.push_back(InputRun{ packed, 1 });
+    }
+    ticks++;
+}
+
+bool InputRecorder::save(const std::string& filename, sf::Vector2f viewSize) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cout << "Failed to write recording: " << filename << std::endl;
+        return false;
+    }
+
+    InputHeader header = {};
+    std::memcpy(header.magic, "INP1", 4);
+    header.tickCount = ticks;
+    header.runCount = runs.size();
+    header.viewWidth = viewSize.x;
+    header.viewHeight = viewSize.y;
+    std::strncpy(header.level, level.c_str(), sizeof(header.level) - 1);
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!runs.empty()) file.write(reinterpret_cast<const char*>(runs.data()), runs.size() * sizeof(InputRun));
+    return static_cast<bool>(file);
+}
+
+unsigned InputRecorder::getTickCount() const {
+    return ticks;
+}
+
+// The ReplayInput class, which plays a recording back
+ReplayInput::ReplayInput() : header(), run(0), tickInRun(0), current(0) {}
+
+bool ReplayInput::load(const std::string& filename) {
+    runs.clear();
+    run = 0;
+    tickInRun = 0;
+    current = 0;
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "INP1", 4) != 0) {
+        std::cout << "Failed to load recording: " << filename << std::endl;
+        return false;
+    }
+    header.level[sizeof(header.level) - 1] = '\0';
+    level = header.level;
+
+    runs.resize(header.runCount);
+    if (!runs.empty() && !file.read(reinterpret_cast<char*>(runs.data()), runs.size() * sizeof(InputRun))) {
+        std::cout << "Truncated recording: " << filename << std::endl;
+        runs.clear();
+        return false;
+    }
+    return true;
+}
+
+unsigned ReplayInput::poll() {
+    while (run < runs.size() && tickInRun >= runs[run].ticks) {
+        run++;
+        tickInRun = 0;
+    }
+    if (run >= runs.size()) {
+        current = 0;
+        return 0;
+    }
+    tickInRun++;
+    current = runs[run].keys;
+    return current & 0xff;
+}
+
+bool ReplayInput::pollPresses(unsigned& pressed) {
+    pressed = current >> 8;
+    return true;
+}
+
+bool ReplayInput::finished() const {
+    return run >= runs.size() || (run == runs.size() - 1 && tickInRun >= runs[run].ticks);
+}
+
+const std::string& ReplayInput::getLevel() const {
+    return level;
+}
+
+sf::Vector2f ReplayInput::getViewSize() const {
+    return sf::Vector2f(header.viewWidth, header.viewHeight);
+}
+
+unsigned ReplayInput::getTickCount() const {
+    return header.tickCount;
+}
+
+void SpriteFrame::apply(sf::Sprite& sprite) const {
+    sprite.setTexture(*texture);
+    sprite.setTextureRect(rect);
+}
+
+std::shared_ptr<sf::Image> AssetManager::getImage(const std::string& filename) {
+    StreamedImage* streamed = findStream(filename);
+    if (streamed) {
+        while (!streamed->ready) std::this_thread::yield();
+        return streamed->image;
+    }
+
+    std::shared_ptr<sf::Image> image = images[filename].lock();
+    if (!image) {
+        image = std::make_shared<sf::Image>();
+        if (!image->loadFromFile(filename))
+            std::cout << "Failed to load image: " << filename << std::endl;
+        images[filename] = image;
+    }
+    return image;
+}
+
+std::shared_ptr<sf::Font> AssetManager::getFont(const std::string& filename) {
+    std::shared_ptr<sf::Font> font = fonts[filename].lock();
+    if (!font) {
+        font = std::make_shared<sf::Font>();
+        if (!font->loadFromFile(filename))
+            std::cout << "Note: Using default font (" << filename << " not found)" << std::endl;
+        fonts[filename] = font;
+    }
+    return font;
+}
+
+bool AssetManager::setHeadless(bool enabled) {
+    headless = enabled;
+    return enabled;
+}
+
+bool AssetManager::isHeadless() {
+    return headless;
+}
+
+std::shared_ptr<sf::Texture> AssetManager::getTexture(const std::string& filename) {
+    std::shared_ptr<sf::Texture> texture = textures[filename].lock();
+    if (!texture) {
+        texture = std::make_shared<sf::Texture>();
+        StreamedImage* streamed = headless ? nullptr : findStream(filename);
+        if (streamed && !streamed->ready) {
+            pendingUploads.push_back(PendingUpload{ texture, filename, sf::IntRect() });
+        } else if (streamed) {
+            if (!texture->loadFromImage(*streamed->image))
+                std::cout << "Failed to load texture: " << filename << std::endl;
+        } else if (!headless) {
+            // A preloaded image only needs uploading
+            std::shared_ptr<sf::Image> image = images[filename].lock();
+            bool loaded = image ? texture->loadFromImage(*image) : texture->loadFromFile(filename);
+            if (!loaded)
+                std::cout << "Failed to load texture: " << filename << std::endl;
+        }
+        textures[filename] = texture;
+    }
+    return texture;
+}
+
+std::shared_ptr<sf::Texture> AssetManager::getTexture(const std::string& filename, const sf::IntRect& area) {
+    std::string key = filename + "#" + std::to_string(area.left) + "," + std::to_string(area.top) + ","
+        + std::to_string(area.width) + "," + std::to_string(area.height);
+
+    std::shared_ptr<sf::Texture> texture = textures[key].lock();
+    if (!texture) {
+        texture = std::make_shared<sf::Texture>();
+        StreamedImage* streamed = headless ? nullptr : findStream(filename);
+        if (streamed && !streamed->ready) {
+            pendingUploads.push_back(PendingUpload{ texture, filename, area });
+        } else if (!headless && !texture->loadFromImage(*getImage(filename), area)) {
+            std::cout << "Failed to create texture: " << key << std::endl;
+        }
+        textures[key] = texture;
+    }
+    return texture;
+}
+
+std::vector<std::shared_ptr<sf::Image>> AssetManager::preload(const std::vector<std::string>& files, unsigned threads) {
+    std::vector<std::shared_ptr<sf::Image>> decoded(files.size());
+    std::vector<char> loaded(files.size(), 1);
+
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < files.size(); i++) {
+        decoded[i] = images[files[i]].lock();
+        if (!decoded[i]) missing.push_back(i);
+    }
+    if (missing.empty()) return decoded;
+
+    // Each job writes only its own slot; the cache is filled afterwards on
+    // the calling thread
+    ThreadPool pool(std::min<unsigned>(threads, missing.size()));
+    for (size_t i : missing) {
+        decoded[i] = std::make_shared<sf::Image>();
+        pool.submit([&decoded, &loaded, &files, i]() {
+            loaded[i] = decoded[i]->loadFromFile(files[i]);
+        });
+    }
+    pool.wait();
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!loaded[i]) std::cout << "Failed to load image: " << files[i] << std::endl;
+        images[files[i]] = decoded[i];
+    }
+    return decoded;
+}
+
+std::vector<std::string> AssetManager::startupFiles() {
+    if (!atlasIndexLoaded) loadAtlasIndex();
+
+    std::vector<std::string> files;
+    if (!headless) {
+        files.push_back("PNGS/bgimg.png");
+        files.push_back("PNGS/mainmenu.png");
+    }
+    for (const AtlasSource& source : atlasSources) {
+        // Baked frames are raw pixels, and headless games only decode
+        // images whose size they need
+        if (atlasFrames.count(source.name)) continue;
+        if (headless && source.rect.width > 0) continue;
+        if (std::find(files.begin(), files.end(), source.filename) == files.end())
+            files.push_back(source.filename);
+    }
+    return files;
+}
+
+std::vector<std::string> AssetManager::menuFiles() {
+    if (!atlasIndexLoaded) loadAtlasIndex();
+
+    std::vector<std::string> files;
+    files.push_back("PNGS/mainmenu.png");
+    for (const AtlasSource& source : atlasSources) {
+        if (std::strcmp(source.name, "title") == 0 && !atlasFrames.count(source.name))
+            files.push_back(source.filename);
+    }
+    return files;
+}
+
+AssetManager::StreamedImage* AssetManager::findStream(const std::string& filename) {
+    for (const std::unique_ptr<StreamedImage>& streamed : streams) {
+        if (streamed->filename == filename) return streamed.get();
+    }
+    return nullptr;
+}
+
+void AssetManager::stream(const std::vector<std::string>& files) {
+    // One core stays free for the window
+    unsigned cores = std::thread::hardware_concurrency();
+    if (!streamPool) streamPool.reset(new ThreadPool(cores > 1 ? cores - 1 : 1));
+
+    for (const std::string& filename : files) {
+        if (findStream(filename)) continue;
+
+        std::unique_ptr<StreamedImage> streamed(new StreamedImage());
+        streamed->filename = filename;
+        streamed->image = std::make_shared<sf::Image>();
+        streamed->loaded = false;
+        streamed->ready = false;
+
+        StreamedImage* slot = streamed.get();
+        streams.push_back(std::move(streamed));
+        streamPool->submit([slot]() {
+            slot->loaded = slot->image->loadFromFile(slot->filename);
+            slot->ready.store(true, std::memory_order_release);
+        });
+    }
+}
+
+bool AssetManager::updateStreaming() {
+    for (size_t i = 0; i < pendingUploads.size(); ) {
+        PendingUpload& upload = pendingUploads[i];
+        StreamedImage* streamed = findStream(upload.filename);
+        if (!streamed->ready.load(std::memory_order_acquire)) {
+            i++;
+            continue;
+        }
+
+        bool uploaded = upload.area.width > 0 ? upload.texture->loadFromImage(*streamed->image, upload.area)
+                                              : upload.texture->loadFromImage(*streamed->image);
+        if (streamed->loaded && !uploaded)
+            std::cout << "Failed to load texture: " << upload.filename << std::endl;
+        pendingUploads.erase(pendingUploads.begin() + i);
+    }
+    if (!pendingUploads.empty()) return false;
+
+    for (const std::unique_ptr<StreamedImage>& streamed : streams) {
+        if (!streamed->ready.load(std::memory_order_acquire)) return false;
+    }
+
+    // Everything is on the GPU; the decoded copies and the workers can go
+    for (const std::unique_ptr<StreamedImage>& streamed : streams) {
+        if (!streamed->loaded) std::cout << "Failed to load image: " << streamed->filename << std::endl;
+    }
+    streams.clear();
+    streamPool.reset();
+    return true;
+}
+
+sf::Vector2u AssetManager::getImageSize(const std::string& filename) {
+    // Whatever is already decoded or uploaded knows its size
+    if (headless) {
+        std::map<std::string, std::weak_ptr<sf::Image>>::iterator cached = images.find(filename);
+        std::shared_ptr<sf::Image> image = cached != images.end() ? cached->second.lock() : nullptr;
+        if (image) return image->getSize();
+    } else {
+        std::shared_ptr<sf::Texture> texture = textures[filename].lock();
+        if (texture && texture->getSize().x > 0) return texture->getSize();
+    }
+
+    // PNG signature, then the IHDR chunk with big-endian width and height
+    unsigned char header[24];
+    std::ifstream file(filename, std::ios::binary);
+    if (file.read(reinterpret_cast<char*>(header), sizeof(header))
+        && std::memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 && std::memcmp(header + 12, "IHDR", 4) == 0) {
+        unsigned width  = header[16] << 24 | header[17] << 16 | header[18] << 8 | header[19];
+        unsigned height = header[20] << 24 | header[21] << 16 | header[22] << 8 | header[23];
+        return sf::Vector2u(width, height);
+    }
+    // A missing or damaged PNG is reported when its texture loads; only
+    // other formats are worth decoding for their size
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".png") == 0) return sf::Vector2u(0, 0);
+    return getImage(filename)->getSize();
+}
+
+void AssetManager::loadAtlasIndex() {
+    atlasIndexLoaded = true;
+
+    std::ifstream file(atlasFile, std::ios::binary);
+    if (!file) return;
+
+    AtlasHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, "ATL1", 4) != 0) {
+        std::cout << "Ignoring invalid atlas: " << atlasFile << std::endl;
+        return;
+    }
+
+    for (uint32_t i = 0; i < header.frameCount; i++) {
+        AtlasEntry entry;
+        file.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+        if (!file) {
+            atlasFrames.clear();
+            return;
+        }
+        entry.name[sizeof(entry.name) - 1] = '\0';
+        atlasFrames[entry.name] = sf::IntRect(entry.x, entry.y, entry.width, entry.height);
+    }
+}
+
+std::shared_ptr<sf::Texture> AssetManager::getAtlasTexture() {
+    std::shared_ptr<sf::Texture> texture = textures[atlasFile].lock();
+    if (texture) return texture;
+
+    texture = std::make_shared<sf::Texture>();
+    textures[atlasFile] = texture;
+    if (headless) return texture;
+
+    // The pixels are stored raw, so this is a straight read and upload
+    std::ifstream file(atlasFile, std::ios::binary);
+    AtlasHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.seekg(sizeof(AtlasHeader) + header.frameCount * sizeof(AtlasEntry));
+
+    std::vector<sf::Uint8> pixels(static_cast<size_t>(header.width) * header.height * 4);
+    file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
+    if (!file || !texture->create(header.width, header.height)) {
+        std::cout << "Failed to load atlas: " << atlasFile << std::endl;
+        return texture;
+    }
+    texture->update(pixels.data());
+    return texture;
+}
+
+SpriteFrame AssetManager::getFrame(const std::string& name) {
+    if (!atlasIndexLoaded) loadAtlasIndex();
+
+    SpriteFrame frame;
+    std::map<std::string, sf::IntRect>::const_iterator baked = atlasFrames.find(name);
+    if (baked != atlasFrames.end()) {
+        frame.texture = getAtlasTexture();
+        frame.rect = baked->second;
+        return frame;
+    }
+
+    // No atlas (or an unknown frame): fall back to cutting it from its sheet
+    std::string filename = name;
+    sf::IntRect area;
+    for (const AtlasSource& source : atlasSources) {
+        if (name == source.name) {
+            filename = source.filename;
+            area = source.rect;
+            break;
+        }
+    }
+
+    if (area.width > 0) {
+        frame.texture = getTexture(filename, area);
+        frame.rect = sf::IntRect(0, 0, area.width, area.height);
+    } else {
+        frame.texture = getTexture(filename);
+        sf::Vector2u size = getImageSize(filename);
+        frame.rect = sf::IntRect(0, 0, size.x, size.y);
+    }
+    return frame;
+}
+
+bool AssetManager::packAtlas(const std::string& filename) {
+    struct Packed {
+        const AtlasSource* source;
+        std::shared_ptr<sf::Image> image;
+        sf::IntRect rect;
+        sf::Vector2i position;
+    };
+
+    std::vector<Packed> frames;
+    for (const AtlasSource& source : atlasSources) {
+        Packed packed;
+        packed.source = &source;
+        packed.image = getImage(source.filename);
+        sf::Vector2u size = packed.image->getSize();
+        if (size.x == 0 || size.y == 0) return false;
+
+        packed.rect = source.rect.width > 0 ? source.rect : sf::IntRect(0, 0, size.x, size.y);
+        frames.push_back(packed);
+    }
+
+    // Simple shelf packing: tallest frames first, rows no wider than maxWidth,
+    // one pixel of padding so filtering never bleeds between frames
+    const int maxWidth = 4096;
+    const int padding = 1;
+    std::vector<Packed*> order;
+    for (Packed& packed : frames) order.push_back(&packed);
+    std::sort(order.begin(), order.end(), [](const Packed* a, const Packed* b) {
+        return a->rect.height > b->rect.height;
+    });
+
+    int x = 0, y = 0, rowHeight = 0, width = 0;
+    for (Packed* packed : order) {
+        if (packed->rect.width > maxWidth) {
+            std::cout << "Frame too wide for atlas: " << packed->source->name << std::endl;
+            return false;
+        }
+        if (x + packed->rect.width > maxWidth) {
+            x = 0;
+            y += rowHeight + padding;
+            rowHeight = 0;
+        }
+        packed->position = sf::Vector2i(x, y);
+        x += packed->rect.width + padding;
+        rowHeight = std::max(rowHeight, packed->rect.height);
+        width = std::max(width, x);
+    }
+    int height = y + rowHeight;
+
+    sf::Image atlas;
+    atlas.create(width, height, sf::Color::Transparent);
+    for (const Packed& packed : frames) {
+        atlas.copy(*packed.image, packed.position.x, packed.position.y, packed.rect, false);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    AtlasHeader header;
+    std::memcpy(header.magic, "ATL1", 4);
+    header.width = width;
+    header.height = height;
+    header.frameCount = frames.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const Packed& packed : frames) {
+        AtlasEntry entry = {};
+        std::strncpy(entry.name, packed.source->name, sizeof(entry.name) - 1);
+        entry.x = packed.position.x;
+        entry.y = packed.position.y;
+        entry.width = packed.rect.width;
+        entry.height = packed.rect.height;
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    }
+
+    file.write(reinterpret_cast<const char*>(atlas.getPixelsPtr()), static_cast<size_t>(width) * height * 4);
+    std::cout << "Packed " << frames.size() << " frames into " << width << "x" << height
+              << " atlas: " << filename << std::endl;
+    return static_cast<bool>(file);
+}
+
+// The SpriteBatch class, which turns many sprites into a few draw calls
+void SpriteBatch::clear() {
+    // Keep the groups and their storage around for the next frame
+    for (Group& group : groups) {
+        group.vertices.clear();
+    }
+}
+
+SpriteBatch::Quad SpriteBatch::makeQuad(const sf::Sprite& sprite) {
+    sf::IntRect rect = sprite.getTextureRect();
+    sf::FloatRect local = sprite.getLocalBounds();
+    sf::Transform transform = sprite.getTransform();
+    sf::Color color = sprite.getColor();
+
+    float u0 = rect.left, u1 = rect.left + rect.width;
+    float v0 = rect.top, v1 = rect.top + rect.height;
+    sf::Vertex topLeft(transform.transformPoint(0.f, 0.f), color, sf::Vector2f(u0, v0));
+    sf::Vertex topRight(transform.transformPoint(local.width, 0.f), color, sf::Vector2f(u1, v0));
+    sf::Vertex bottomRight(transform.transformPoint(local.width, local.height), color, sf::Vector2f(u1, v1));
+    sf::Vertex bottomLeft(transform.transformPoint(0.f, local.height), color, sf::Vector2f(u0, v1));
+
+    Quad quad = { sprite.getTexture(), { topLeft, topRight, bottomRight, topLeft, bottomRight, bottomLeft } };
+    return quad;
+}
+
+void SpriteBatch::add(const sf::Sprite& sprite) {
+    add(makeQuad(sprite));
+}
+
+void SpriteBatch::add(const Quad& quad) {
+    Group* group = nullptr;
+    for (Group& candidate : groups) {
+        if (candidate.texture == quad.texture) {
+            group = &candidate;
+            break;
+        }
+    }
+    if (!group) {
+        groups.push_back(Group{ quad.texture, sf::VertexArray(sf::Triangles) });
+        group = &groups.back();
+    }
+
+    for (const sf::Vertex& vertex : quad.vertices) {
+        group->vertices.append(vertex);
+    }
+}
+
+void SpriteBatch::draw(sf::RenderTarget& target) const {
+    for (const Group& group : groups) {
+        if (group.vertices.getVertexCount() == 0) continue;
+        target.draw(group.vertices, sf::RenderStates(group.texture));
+    }
+}
+
+int SpriteBatch::drawCalls() const {
+    int calls = 0;
+    for (const Group& group : groups) {
+        if (group.vertices.getVertexCount() > 0) calls++;
+    }
+    return calls;
+}
+
+// The SpatialGrid class, which buckets the level's platforms so collision
+// only tests the ones near the character
+SpatialGrid::SpatialGrid(float cellSize) : cellSize(cellSize) {}
+
+void SpatialGrid::clear() {
+    rects.clear();
+    cells.clear();
+}
+
+long long SpatialGrid::cellKey(int cellX, int cellY) const {
+    return (static_cast<long long>(cellX) << 32) ^ static_cast<unsigned int>(cellY);
+}
+
+int SpatialGrid::insert(const sf::FloatRect& rect) {
+    int index = rects.size();
+    rects.push_back(rect);
+
+    int left   = std::floor(rect.left / cellSize);
+    int right  = std::floor((rect.left + rect.width) / cellSize);
+    int top    = std::floor(rect.top / cellSize);
+    int bottom = std::floor((rect.top + rect.height) / cellSize);
+
+    for (int x = left; x <= right; x++) {
+        for (int y = top; y <= bottom; y++) {
+            cells[cellKey(x, y)].push_back(index);
+        }
+    }
+    return index;
+}
+
+void SpatialGrid::query(const sf::FloatRect& area, std::vector<int>& result) const {
+    result.clear();
+
+    int left   = std::floor(area.left / cellSize);
+    int right  = std::floor((area.left + area.width) / cellSize);
+    int top    = std::floor(area.top / cellSize);
+    int bottom = std::floor((area.top + area.height) / cellSize);
+
+    for (int x = left; x <= right; x++) {
+        for (int y = top; y <= bottom; y++) {
+            std::unordered_map<long long, std::vector<int>>::const_iterator cell = cells.find(cellKey(x, y));
+            if (cell == cells.end()) continue;
+
+            for (int index : cell->second) {
+                if (area.intersects(rects[index])) result.push_back(index);
+            }
+        }
+    }
+
+    // A rect spanning several cells shows up once per cell
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+const sf::FloatRect& SpatialGrid::getRect(int index) const {
+    return rects[index];
+}
+
+int SpatialGrid::size() const {
+    return rects.size();
+}
 
 // Constructor of the abstract base class
 UIElement::UIElement() {
-    if (!font.loadFromFile("arial.ttf")) {
-        std::cout << "Note: Using default font (arial.ttf not found)" << std::endl;
-    }
-    text.setFont(font);
+    font = AssetManager::getFont("arial.ttf");
+    text.setFont(*font);
     text.setCharacterSize(24);
     text.setFillColor(sf::Color::White);
+    dirty = true;
+}
+
+bool UIElement::isDirty() const {
+    return dirty;
+}
+
+void UIElement::markClean() {
+    dirty = false;
 }
 
 // The HealthBar class, which draws and updates the health bar based on the health
 // of the player
-HealthBar::HealthBar(int* health, int maxHP) : playerHealth(health), maxHealth(maxHP) {
-    fullHealthTexture.loadFromFile("PNGS/fullhealth.png");
-    lowHealthTexture.loadFromFile("PNGS/nohealth.png");
-}
+HealthBar::HealthBar(int* health, int maxHP) : playerHealth(health), shownHealth(-1), maxHealth(maxHP) {
+    fullHealthFrame = AssetManager::getFrame("fullhealth");
+    lowHealthFrame = AssetManager::getFrame("nohealth");
 
-void HealthBar::draw(sf::RenderWindow& window) {
+    // Filling the batch with every heart in both frames once leaves it room
+    // for any health value, so later changes do not allocate
     for (int i = 0 ; i < 10 ; i++) {
         healthSprites[i].setScale(0.2f , 0.2f);
         healthSprites[i].setPosition(20 + i * 75, 20);
-        window.draw(healthSprites[i]);
+        fullHealthFrame.apply(healthSprites[i]);
+        batch.add(healthSprites[i]);
+        lowHealthFrame.apply(healthSprites[i]);
+        batch.add(healthSprites[i]);
     }
+    batch.clear();
+}
+
+void HealthBar::draw(sf::RenderTarget& target) {
+    batch.draw(target);
 }
 
 void HealthBar::update() {
+    // Health changes a few times a minute; nothing to do in between
+    if (*playerHealth == shownHealth) return;
+    shownHealth = *playerHealth;
+
+    batch.clear();
     for (int i = 0 ; i < 10 ; i++) {
-        if (i+1 <= *playerHealth/10) {
-            healthSprites[i].setTexture(fullHealthTexture);
+        if (i+1 <= shownHealth/10) {
+            fullHealthFrame.apply(healthSprites[i]);
         } else {
-            healthSprites[i].setTexture(lowHealthTexture);
+            lowHealthFrame.apply(healthSprites[i]);
         }
+        batch.add(healthSprites[i]);
     }
+    dirty = true;
 }
 
 void HealthBar::takeDamage(int damage) {
@@ -42,35 +994,108 @@ void HealthBar::takeDamage(int damage) {
     }
 }
 
-// The SourlBar class, which draws and updates the soul bar based on the health
-// of the player
-SoulBar::SoulBar(int* soul) : playerSoul(soul) {
-    texture.loadFromFile("PNGS/soulorb.png");
-    for (int i = 0 ; i < 4 ; i++) {
-        sprites[i].setTexture(texture);
-    }
+// The SourlBar class, which draws and updates the soul bar based on the health
+// of the player
+SoulBar::SoulBar(int* soul) : playerSoul(soul), shownSoul(-1) {
+    frame = AssetManager::getFrame("soulorb");
+    for (int i = 0 ; i < 4 ; i++) {
+        frame.apply(sprites[i]);
+        sprites[i].setScale(0.5f , 0.5f);
+        sprites[i].setPosition(20 + i * 75, 100);
+        batch.add(sprites[i]);
+    }
+    batch.clear();
+
+    char soulText[32];
+    for (int soul = 0; soul <= maxSoul; soul++) {
+        std::snprintf(soulText, sizeof(soulText), "Soul: %d", soul);
+        labels[soul] = soulText;
+    }
+}
+
+void SoulBar::draw(sf::RenderTarget& target) {
+    batch.draw(target);
+}
+
+void SoulBar::update() {
+    // Only when it changes, and from a ready-made label: turning a char
+    // string into an sf::String allocates
+    if (*playerSoul == shownSoul) return;
+    shownSoul = *playerSoul;
+
+    if (shownSoul >= 0 && shownSoul <= maxSoul) {
+        text.setString(labels[shownSoul]);
+    } else {
+        char soulText[32];
+        std::snprintf(soulText, sizeof(soulText), "Soul: %d", shownSoul);
+        text.setString(soulText);
+    }
+
+    batch.clear();
+    for (int i = 0 ; i < shownSoul / 5 ; i++) {
+        batch.add(sprites[i]);
+    }
+    dirty = true;
+}
+
+// The FrameTimeGraph class, which plots how long recent frames took
+static const char* labelFormat = "worst %6.1f ms";
+
+FrameTimeGraph::FrameTimeGraph() : next(0), graph(sf::LineStrip, history), position(20.f, 200.f) {
+    for (int i = 0; i < history; i++) times[i] = 0.f;
+    std::snprintf(label, sizeof(label), labelFormat, 0.f);
+    labelText = label;
+    text.setString(labelText);
+
+    budgetLine.setSize(sf::Vector2f(history, 1.f));
+    budgetLine.setFillColor(sf::Color(255, 255, 0, 128));
+    text.setCharacterSize(16);
+    text.setPosition(position.x, position.y + 5.f);
 }
 
-void SoulBar::draw(sf::RenderWindow& window) {
-    for (int i = 0 ; i < (*playerSoul) / 5 ; i++) {
-        sprites[i].setScale(0.5f , 0.5f);
-        sprites[i].setPosition(20 + i * 75, 100);
-        window.draw(sprites[i]);
+void FrameTimeGraph::record(float milliseconds) {
+    times[next] = milliseconds;
+    next = (next + 1) % history;
+}
+
+void FrameTimeGraph::update() {
+    // Two pixels per millisecond, oldest frame on the left
+    const float height = 66.f;
+    float worst = 0.f;
+    for (int i = 0; i < history; i++) {
+        float time = times[(next + i) % history];
+        worst = std::max(worst, time);
+        float y = position.y + height - std::min(time * 2.f, height);
+        graph[i].position = sf::Vector2f(position.x + i, y);
+        graph[i].color = time > 1000.f / 60.f ? sf::Color::Red : sf::Color::Green;
+    }
+    budgetLine.setPosition(position.x, position.y + height - 2.f * 1000.f / 60.f);
+
+    char worstText[32];
+    std::snprintf(worstText, sizeof(worstText), labelFormat, std::min(worst, 9999.9f));
+    if (std::strcmp(worstText, label) != 0) {
+        std::strcpy(label, worstText);
+        for (size_t i = 0; i < labelText.getSize(); i++) labelText[i] = static_cast<unsigned char>(label[i]);
+        text.setString(labelText);
     }
+    dirty = true;
 }
 
-void SoulBar::update() {
-    std::string soulText = "Soul: " + std::to_string(*playerSoul);
-    text.setString(soulText);
+void FrameTimeGraph::draw(sf::RenderTarget& target) {
+    target.draw(budgetLine);
+    target.draw(graph);
+    target.draw(text);
 }
 
 // The Background class, which creates a background for the window
 Background::Background(const std::string& filename)
 {
-    if (!texture.loadFromFile(filename)) {
-        std::cout << "Failed to load background: " << filename << std::endl;
-    }
-    sprite.setTexture(texture);
+    texture = AssetManager::getTexture(filename);
+    sprite.setTexture(*texture);
+
+    // The texture may still be streaming in and empty
+    sf::Vector2u size = AssetManager::getImageSize(filename);
+    sprite.setTextureRect(sf::IntRect(0, 0, size.x, size.y));
 }
 
 void Background::draw(sf::RenderWindow& window)
@@ -80,7 +1105,7 @@ void Background::draw(sf::RenderWindow& window)
 
 // The abstract character class
 Character::Character() : vx(0), vy(0), gravity(800.f), health(100), 
-facingRight(true), onGround(false) {}
+facingRight(true), onGround(false), deterministic(false), body() {}
 
 sf::FloatRect Character::getBounds() const {
     return sprite.getGlobalBounds();
@@ -90,49 +1115,227 @@ sf::Vector2f Character::getPosition() const {
     return sprite.getPosition();
 }
 
+void Character::setPosition(float x, float y) {
+    sprite.setPosition(x, y);
+    body.x = Fixed::fromFloat(x);
+    body.y = Fixed::fromFloat(y);
+}
+
 bool Character::isFacingRight() const {
     return facingRight;
 }
 
+void Character::setDeterministic(bool enabled) {
+    deterministic = enabled;
+
+    // Start from exactly where the float path left off
+    sf::FloatRect bounds = getBounds();
+    setPosition(sprite.getPosition().x, sprite.getPosition().y);
+    body.width = Fixed::fromFloat(bounds.width);
+    body.height = Fixed::fromFloat(bounds.height);
+    setVelocity(vx, vy);
+}
+
+// Folds integers into an FNV-1a hash a byte at a time, lowest byte first,
+// so the result does not depend on the machine's byte order
+static uint64_t hashValues(uint64_t hash, const int64_t* values, int count) {
+    for (int v = 0; v < count; v++) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= static_cast<uint64_t>(values[v] >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+uint64_t Character::stateHash() const {
+    const int64_t values[] = { body.x.raw, body.y.raw, body.vx.raw, body.vy.raw, onGround, facingRight };
+    return hashValues(14695981039346656037ull, values, 6);
+}
+
+void Character::setVelocity(float x, float y) {
+    vx = x;
+    vy = y;
+    body.vx = Fixed::fromFloat(x);
+    body.vy = Fixed::fromFloat(y);
+}
+
+void Character::move(float dt, const SpatialGrid& level) {
+    if (deterministic) moveFixed(dt, level);
+    else moveFloat(dt, level);
+}
+
+void Character::moveFloat(float dt, const SpatialGrid& level) {
+    vy += gravity * dt;
+    sf::Vector2f currentPos = sprite.getPosition();
+    sf::Vector2f newPos = currentPos + sf::Vector2f(vx * dt, vy * dt);
+    
+    sprite.setPosition(newPos.x, currentPos.y);
+    
+    sf::FloatRect bounds = getBounds();
+    level.query(bounds, hits);
+    bool horizontalCollision = !hits.empty();
+    
+    if (horizontalCollision) {
+        sprite.setPosition(currentPos.x, currentPos.y);
+        vx = 0;
+    }
+    
+    sprite.setPosition(sprite.getPosition().x, newPos.y);
+    
+    bounds = getBounds();
+    onGround = false;
+    
+    level.query(bounds, hits);
+    if (!hits.empty()) {
+        sf::FloatRect platform = level.getRect(hits[0]);
+        
+        if (vy > 0 && bounds.top + bounds.height > platform.top) {
+            sprite.setPosition(sprite.getPosition().x, platform.top - bounds.height);
+            vy = 0;
+            onGround = true;
+        }
+        else if (vy < 0 && bounds.top < platform.top + platform.height) {
+            sprite.setPosition(sprite.getPosition().x, platform.top + platform.height);
+            vy = 0;
+        }
+    }
+}
+
+// The same steps as moveFloat. The sprite and the float velocity only
+// mirror the body, so nothing float feeds back into the next tick.
+void Character::moveFixed(float dt, const SpatialGrid& level) {
+    Fixed step = Fixed::fromFloat(dt);
+    Fixed zero = Fixed{ 0 };
+    body.vx = Fixed::fromFloat(vx);
+    body.vy = body.vy + Fixed::fromFloat(gravity) * step;
+    Fixed newX = body.x + body.vx * step;
+    Fixed newY = body.y + body.vy * step;
+
+    findHits(level, newX, body.y);
+    if (hits.empty()) body.x = newX;
+    else body.vx = zero;
+
+    body.y = newY;
+    onGround = false;
+
+    findHits(level, body.x, body.y);
+    if (!hits.empty()) {
+        const sf::FloatRect& rect = level.getRect(hits[0]);
+        Fixed top = Fixed::fromFloat(rect.top);
+        Fixed bottom = top + Fixed::fromFloat(rect.height);
+
+        if (body.vy > zero && body.y + body.height > top) {
+            body.y = top - body.height;
+            body.vy = zero;
+            onGround = true;
+        }
+        else if (body.vy < zero && body.y < bottom) {
+            body.y = bottom;
+            body.vy = zero;
+        }
+    }
+
+    vx = body.vx.toFloat();
+    vy = body.vy.toFloat();
+    sprite.setPosition(body.x.toFloat(), body.y.toFloat());
+}
+
+void Character::findHits(const SpatialGrid& level, Fixed x, Fixed y) {
+    // The grid narrows the search in floats, with a pixel to spare; the
+    // overlap test that decides is done in fixed point
+    sf::FloatRect area(x.toFloat() - 1.f, y.toFloat() - 1.f, body.width.toFloat() + 2.f, body.height.toFloat() + 2.f);
+    level.query(area, hits);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < hits.size(); i++) {
+        const sf::FloatRect& rect = level.getRect(hits[i]);
+        Fixed left = Fixed::fromFloat(rect.left);
+        Fixed top = Fixed::fromFloat(rect.top);
+        if (x < left + Fixed::fromFloat(rect.width) && left < x + body.width &&
+            y < top + Fixed::fromFloat(rect.height) && top < y + body.height) {
+            hits[kept++] = hits[i];
+        }
+    }
+    hits.resize(kept);
+}
+
 // The Player class, derived from Character, which is controlled by the user
-Player::Player() : maxHealth(100), moveSpeed(300.f), jumpForce(-550.f),
+Player::Player() : input(0), maxHealth(100), moveSpeed(300.f), jumpForce(-550.f),
     soul(0), maxSoul(20), isAttacking(false), attackDuration(0.f), 
     attackCooldown(0.f), attacked(true), damage(25)
 {
-    sf::Image fullImage;
-    if (fullImage.loadFromFile("PNGS/player.png")) {
-        sf::IntRect frameRect(4025, 3965, 71, 130);
-        sf::Image frameImage;
-        frameImage.create(frameRect.width, frameRect.height, sf::Color::Transparent);
-        frameImage.copy(fullImage, 0, 0, frameRect, true);
-        texture.loadFromImage(frameImage);
-
-        sf::IntRect attackFrameRect(1770, 2777, 108, 43);
-        sf::Image attackFrameImage;
-        attackFrameImage.create(attackFrameRect.width, attackFrameRect.height, sf::Color::Transparent);
-        attackFrameImage.copy(fullImage, 0, 0, attackFrameRect, true);
-        attackTexture.loadFromImage(attackFrameImage);
-    }
+    frame = AssetManager::getFrame("player");
+    attackFrame = AssetManager::getFrame("player_attack");
 
-    sprite.setTexture(texture);
+    frame.apply(sprite);
     sprite.setScale(1.0f, 1.0f); 
-    sprite.setPosition(100.f, 200.f);
+    setPosition(100.f, 200.f);
     facingRight = true;
 
-    attackSprite.setTexture(attackTexture);
+    frame.apply(renderSprite);
+    attackFrame.apply(attackSprite);
+}
+
+PlayerState Player::saveState() const {
+    PlayerState saved = {};
+    saved.x = sprite.getPosition().x;
+    saved.y = sprite.getPosition().y;
+    saved.bodyX = body.x;
+    saved.bodyY = body.y;
+    saved.bodyVx = body.vx;
+    saved.bodyVy = body.vy;
+    saved.vx = vx;
+    saved.vy = vy;
+    saved.health = health;
+    saved.soul = soul;
+    saved.input = input;
+    saved.facingRight = facingRight;
+    saved.onGround = onGround;
+    saved.isAttacking = isAttacking;
+    saved.attacked = attacked;
+    saved.attackDuration = attackDuration;
+    saved.attackCooldown = attackCooldown;
+    saved.scaleX = sprite.getScale().x;
+    saved.scaleY = sprite.getScale().y;
+    saved.originX = sprite.getOrigin().x;
+    saved.originY = sprite.getOrigin().y;
+    return saved;
+}
+
+void Player::restoreState(const PlayerState& saved) {
+    // The body's size belongs to the frame, not the state, so it is kept
+    sprite.setPosition(saved.x, saved.y);
+    body.x = saved.bodyX;
+    body.y = saved.bodyY;
+    body.vx = saved.bodyVx;
+    body.vy = saved.bodyVy;
+    vx = saved.vx;
+    vy = saved.vy;
+    health = saved.health;
+    soul = saved.soul;
+    input = saved.input;
+    facingRight = saved.facingRight;
+    onGround = saved.onGround;
+    isAttacking = saved.isAttacking;
+    attacked = saved.attacked;
+    attackDuration = saved.attackDuration;
+    attackCooldown = saved.attackCooldown;
+
+    sprite.setScale(saved.scaleX, saved.scaleY);
+    sprite.setOrigin(saved.originX, saved.originY);
 }
 
 void Player::respawn() {
     health = maxHealth;
     soul = 0;
-    vx = 0;
-    vy = 0;
+    setVelocity(0, 0);
 
-    sprite.setPosition(100.f , 200.f);  
+    setPosition(100.f , 200.f);  
     facingRight = true;
     onGround = false;
 
-    std::cout << "Player respawned!" << std::endl;
+    LOG(LogInfo, "Player respawned!");
 }
 
 void Player::meleeAttack() {
@@ -145,8 +1348,10 @@ void Player::meleeAttack() {
 }
 
 sf::FloatRect Player::getAttackHitbox() const {
-    sf::FloatRect b = sprite.getGlobalBounds();
+    return attackHitbox(sprite.getGlobalBounds(), facingRight);
+}
 
+sf::FloatRect Player::attackHitbox(const sf::FloatRect& b, bool facingRight) {
     float width = 45.f;  
     float height = 100.f; 
 
@@ -157,514 +1362,1440 @@ sf::FloatRect Player::getAttackHitbox() const {
 }
 
 
-void Player::update(float dt, sf::FloatRect platformBounds[])
+void Player::update(float dt, const SpatialGrid& level)
 {
+    PROFILE_ZONE("Player::update");
    // std::cout << sprite.getPosition().x << "   " << sprite.getPosition().y << std::endl;
 
     vx = 0.f;
     float scale = 1.0f; 
 
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q)) {
+    if (input & KeyHeal) {
         heal();
     }
 
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) {
+    if (input & KeyLeft) {
         vx = -moveSpeed;
         facingRight = false;
         sprite.setScale(scale, scale);
         sprite.setOrigin(0, 0);
-    } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::D)) {
+    } else if (input & KeyRight) {
         vx = moveSpeed;
         facingRight = true;
         sprite.setScale(-scale, scale);
         sprite.setOrigin(sprite.getLocalBounds().width, 0);
     }
 
-    if (sf::Keyboard::isKeyPressed(sf::Keyboard::W) && onGround) {
-        vy = jumpForce;
+    if ((input & KeyJump) && onGround) {
+        setVelocity(vx, jumpForce);
         onGround = false;
     }
 
-    vy += gravity * dt;
-    sf::Vector2f currentPos = sprite.getPosition();
-    sf::Vector2f newPos = currentPos + sf::Vector2f(vx * dt, vy * dt);
-    
-    sprite.setPosition(newPos.x, currentPos.y);
-    
-    sf::FloatRect playerBounds = getBounds();
-    bool horizontalCollision = false;
-    for (int i = 0; i < 20; i++) {
-        if (playerBounds.intersects(platformBounds[i])) {
-            horizontalCollision = true;
-            break;
+    move(dt, level);
+
+    if (sprite.getPosition().y >= 700.f) respawn();
+
+    if (isAttacking) {
+        attackDuration -= dt;
+        if (attackDuration <= 0.f) {
+            isAttacking = false;
         }
     }
-    
-    if (horizontalCollision) {
-        sprite.setPosition(currentPos.x, currentPos.y);
-        vx = 0;
+
+    if (attackCooldown > 0.f) {
+        attackCooldown -= dt;
+        if (attackCooldown < 0.f) attackCooldown = 0.f;
     }
-    
-    sprite.setPosition(sprite.getPosition().x, newPos.y);
-    
-    playerBounds = getBounds();
-    onGround = false;
-    
-    for (int i = 0; i < 20; i++) {
-        if (playerBounds.intersects(platformBounds[i])) {
-            sf::FloatRect platform = platformBounds[i];
-            
-            if (vy > 0 && playerBounds.top + playerBounds.height > platform.top) {
-                sprite.setPosition(sprite.getPosition().x, platform.top - playerBounds.height);
-                vy = 0;
-                onGround = true;
+
+}
+
+
+PlayerView Player::getView() const {
+    PlayerView view;
+    view.position = sprite.getPosition();
+    view.scale = sprite.getScale();
+    view.origin = sprite.getOrigin();
+    view.color = sprite.getColor();
+    view.facingRight = facingRight;
+    view.attacking = isAttacking;
+    return view;
+}
+
+void Player::draw(SpriteBatch& batch)
+{
+    draw(batch, getView());
+}
+
+void Player::draw(SpriteBatch& batch, const PlayerView& view)
+{
+    renderSprite.setPosition(view.position);
+    renderSprite.setScale(view.scale);
+    renderSprite.setOrigin(view.origin);
+    renderSprite.setColor(view.color);
+    batch.add(renderSprite);
+
+    if (view.attacking) {
+        sf::FloatRect hb = attackHitbox(renderSprite.getGlobalBounds(), view.facingRight);
+        if (view.facingRight) {
+            attackSprite.setPosition(hb.left, hb.top + 50);
+            attackSprite.setScale(1.0f, 1.0f); 
+            batch.add(attackSprite);
+        } else {
+            attackSprite.setPosition(hb.left + 40, hb.top + 50);
+            attackSprite.setScale(-1.0f, 1.0f); 
+            batch.add(attackSprite);
+        }
+    }
+}
+
+void Player::gainSoul(int amount) {
+    soul += amount;
+    if (soul > maxSoul) soul = maxSoul;
+}
+
+void Player::heal() {
+    if (soul >= 5 && health != 100) { 
+        health += 10;
+        if (health > 100) health = 100;
+        soul -= 5;
+    }
+}
+
+void Player::setColor(const sf::Color& color) {
+    sprite.setColor(color);
+}
+
+// The EnemyPool class, which simulates every enemy of the level
+EnemyPool::EnemyPool() : useBatch(true), chaseSpeed(200.f), patrolSpeed(150.f), attackCooldown(1.f), clock(0.0), tickCount(0) {}
+
+int EnemyPool::findKind(const std::string& frameName) {
+    for (int k = 0; k < (int)kindNames.size(); k++) {
+        if (kindNames[k] == frameName) return k;
+    }
+    kindNames.push_back(frameName);
+    kindFrames.push_back(AssetManager::getFrame(frameName));
+    return kindNames.size() - 1;
+}
+
+int EnemyPool::spawn(const EnemySpawn& spawn, int spawnId) {
+    int k = findKind(spawn.frame);
+    const sf::IntRect& rect = kindFrames[k].rect;
+
+    spawns.push_back(spawn);
+    id.push_back(spawnId);
+    x.push_back(Fixed::fromFloat(spawn.x));
+    y.push_back(Fixed::fromFloat(spawn.y));
+    vx.push_back(Fixed{ 0 });
+    patrolLeft.push_back(Fixed::fromFloat(spawn.patrolLeft));
+    patrolRight.push_back(Fixed::fromFloat(spawn.patrolRight));
+    // Squared distances are taken in 64 bits, which holds ranges this far
+    attackRange.push_back(Fixed::fromFloat(std::min(std::max(spawn.attackRange, 0.f), 30000.f)));
+    attackTimer.push_back(Fixed{ 0 });
+    colorTimer.push_back(0.f);
+    despawnTimer.push_back(1.f);
+    steppedAt.push_back(clock);
+    health.push_back(spawn.health);
+    damage.push_back(spawn.damage);
+    isDead.push_back(false);
+    facingRight.push_back(true);
+    isAttacking.push_back(false);
+    isDormant.push_back(false);
+    width.push_back(rect.width * spawn.scale);
+    height.push_back(rect.height * spawn.scale);
+    scale.push_back(spawn.scale);
+    kind.push_back(k);
+    color.push_back(sf::Color::White);
+    return spawns.size() - 1;
+}
+
+template <typename T>
+static void keepFlagged(std::vector<T>& values, const std::vector<unsigned char>& keep) {
+    size_t kept = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (keep[i]) values[kept++] = values[i];
+    }
+    values.resize(kept);
+}
+
+void EnemyPool::retain(const std::vector<unsigned char>& keep) {
+    forEachArray(*this, [&](auto& values) { keepFlagged(values, keep); });
+
+    if (previousX.size() == keep.size()) {
+        keepFlagged(previousX, keep);
+        keepFlagged(previousY, keep);
+    } else {
+        previousX.clear();
+        previousY.clear();
+    }
+}
+
+void EnemyPool::clear() {
+    forEachArray(*this, [](auto& values) { values.clear(); });
+    previousX.clear(); previousY.clear();
+}
+
+// Plain bytes in and out of a snapshot buffer
+template <typename T>
+static void appendBytes(std::vector<unsigned char>& out, const T* values, size_t count) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+static const unsigned char* readBytes(const unsigned char* in, T* values, size_t count) {
+    if (count > 0) std::memcpy(values, in, count * sizeof(T));
+    return in + count * sizeof(T);
+}
+
+void EnemyPool::save(std::vector<unsigned char>& out) const {
+    uint32_t count = size();
+    appendBytes(out, &count, 1);
+    appendBytes(out, &clock, 1);
+    appendBytes(out, &tickCount, 1);
+    forEachArray(*this, [&](const auto& values) { appendBytes(out, values.data(), count); });
+}
+
+bool EnemyPool::restore(const unsigned char* in, const unsigned char* end, int idCount) {
+    const size_t header = sizeof(uint32_t) + sizeof(clock) + sizeof(tickCount);
+    if (static_cast<size_t>(end - in) < header) return false;
+    size_t perEnemy = 0;
+    forEachArray(*this, [&](const auto& values) { perEnemy += sizeof(values[0]); });
+
+    uint32_t count;
+    readBytes(in, &count, 1);
+    if (static_cast<size_t>(end - in) != header + count * perEnemy) return false;
+
+    // Ids and kinds index other tables, so they are checked where they lie
+    // in the buffer before anything is copied
+    bool valid = true;
+    const unsigned char* array = in + header;
+    forEachArray(*this, [&](const auto& values) {
+        const void* which = &values;
+        if (which == &id || which == &kind) {
+            int limit = which == &id ? idCount : static_cast<int>(kindFrames.size());
+            for (uint32_t j = 0; j < count; j++) {
+                int value;
+                std::memcpy(&value, array + j * sizeof(int), sizeof(int));
+                if (value < 0 || value >= limit) valid = false;
+            }
+        }
+        array += count * sizeof(values[0]);
+    });
+    if (!valid) return false;
+
+    in = readBytes(in, &count, 1);
+    in = readBytes(in, &clock, 1);
+    in = readBytes(in, &tickCount, 1);
+    forEachArray(*this, [&](auto& values) {
+        values.resize(count);
+        in = readBytes(in, values.data(), count);
+    });
+
+    // Nothing to interpolate from until the next tick
+    previousX.clear();
+    previousY.clear();
+    return true;
+}
+
+void EnemyPool::savePositions() {
+    // Resized in place, so the vectors keep their capacity
+    previousX.resize(x.size());
+    previousY.resize(y.size());
+    for (int i = 0; i < size(); i++) {
+        previousX[i] = x[i].toFloat();
+        previousY[i] = y[i].toFloat();
+    }
+}
+
+int EnemyPool::size() const {
+    return spawns.size();
+}
+
+bool EnemyPool::allDead() const {
+    for (int i = 0; i < size(); i++) {
+        if (!isDead[i]) return false;
+    }
+    return true;
+}
+
+bool EnemyPool::isVisible(int i) const {
+    return !isDead[i] || despawnTimer[i] > 0;
+}
+
+sf::FloatRect EnemyPool::getBounds(int i) const {
+    // Flipping is done around the sprite's far edge, so the box is the same
+    // whichever way the enemy faces
+    return sf::FloatRect(x[i].toFloat(), y[i].toFloat(), width[i], height[i]);
+}
+
+// Movement and aggro for living, awake enemies in [begin, end), or for
+// dormant ones too when waking them. Attacks are only flagged here; the hit
+// itself is applied in order by update().
+void EnemyPool::stepScalar(int begin, int end, float dt, sf::Vector2f playerPos, bool wake) {
+    const Fixed zero = Fixed{ 0 };
+    const Fixed step = Fixed::fromFloat(dt);
+    const Fixed px = Fixed::fromFloat(playerPos.x);
+    const Fixed targetY = Fixed::fromFloat(playerPos.y + 80.f);
+    const Fixed chase = Fixed::fromFloat(chaseSpeed);
+    const Fixed patrol = Fixed::fromFloat(patrolSpeed);
+
+    for (int i = begin; i < end; i++) {
+        if (isDead[i] || (isDormant[i] && !wake)) continue;
+
+        attackTimer[i] = attackTimer[i] - step;
+        // The box test first keeps both squares, and their sum, in 64 bits
+        int64_t dx = std::llabs((px - x[i]).raw);
+        int64_t dy = std::llabs((targetY - y[i]).raw);
+        int64_t range = attackRange[i].raw;
+        bool inRange = dx <= range && dy <= range && dx * dx + dy * dy <= range * range;
+        bool attack = inRange && attackTimer[i] <= zero;
+
+        Fixed v = zero;
+        if (inRange) {
+            v = zero;
+        } else if (px >= patrolLeft[i] && px <= patrolRight[i]) {
+            v = (px > x[i]) ? chase : -chase;
+        } else {
+            v = (facingRight[i]) ? patrol : -patrol;
+        }
+
+        vx[i] = v;
+        x[i] = x[i] + v * step;
+
+        if (v > zero) facingRight[i] = true;
+        else if (v < zero) facingRight[i] = false;
+
+        if (x[i] >= patrolRight[i]) {
+            x[i] = patrolRight[i];
+            facingRight[i] = false;
+        } else if (x[i] <= patrolLeft[i]) {
+            x[i] = patrolLeft[i];
+            facingRight[i] = true;
+        }
+
+        isAttacking[i] = attack;
+        if (attack) attackTimer[i] = Fixed::fromFloat(attackCooldown);
+    }
+}
+
+#if defined(__AVX2__)
+// Four byte flags as 64-bit lane masks, and back
+static inline __m256i loadFlags(const unsigned char* flags) {
+    int packed;
+    std::memcpy(&packed, flags, 4);
+    __m256i lanes = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+    return _mm256_cmpgt_epi64(lanes, _mm256_setzero_si256());
+}
+
+static inline void storeFlags(unsigned char* flags, __m256i mask) {
+    int bits = _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+    for (int k = 0; k < 4; k++) flags[k] = (bits >> k) & 1;
+}
+
+static inline __m256i select(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline __m256i absolute(__m256i v) {
+    __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), v);
+    return _mm256_sub_epi64(_mm256_xor_si256(v, sign), sign);
+}
+
+static inline __m256i load(const std::vector<Fixed>& values, int i) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&values[i]));
+}
+
+static inline void store(std::vector<Fixed>& values, int i, __m256i lanes) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&values[i]), lanes);
+}
+
+// The same steps as stepScalar for four enemies at a time, one 64-bit lane
+// each. Fixed point needs 64-bit compares, which SSE2 lacks; emulating them
+// there is slower than the scalar loop, so this path needs AVX2.
+int EnemyPool::stepBatch(float dt, sf::Vector2f playerPos) {
+    const Fixed step = Fixed::fromFloat(dt);
+    const Fixed chaseV = Fixed::fromFloat(chaseSpeed);
+    const Fixed patrolV = Fixed::fromFloat(patrolSpeed);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i timeStep = _mm256_set1_epi64x(step.raw);
+    const __m256i px = _mm256_set1_epi64x(Fixed::fromFloat(playerPos.x).raw);
+    const __m256i py = _mm256_set1_epi64x(Fixed::fromFloat(playerPos.y + 80.f).raw);
+    const __m256i chase = _mm256_set1_epi64x(chaseV.raw);
+    const __m256i chaseBack = _mm256_set1_epi64x(-chaseV.raw);
+    const __m256i patrol = _mm256_set1_epi64x(patrolV.raw);
+    const __m256i patrolBack = _mm256_set1_epi64x(-patrolV.raw);
+    const __m256i chaseMove = _mm256_set1_epi64x((chaseV * step).raw);
+    const __m256i chaseBackMove = _mm256_set1_epi64x((-chaseV * step).raw);
+    const __m256i patrolMove = _mm256_set1_epi64x((patrolV * step).raw);
+    const __m256i patrolBackMove = _mm256_set1_epi64x((-patrolV * step).raw);
+    const __m256i cooldown = _mm256_set1_epi64x(Fixed::fromFloat(attackCooldown).raw);
+
+    int count = size() & ~3;
+    for (int i = 0; i < count; i += 4) {
+        // Enemies spawn in level order, so far away ones come in whole groups
+        int asleep, dead;
+        std::memcpy(&asleep, &isDormant[i], 4);
+        std::memcpy(&dead, &isDead[i], 4);
+        if ((asleep | dead) == 0x01010101) continue;
+
+        __m256i alive = _mm256_xor_si256(_mm256_or_si256(loadFlags(&isDead[i]), loadFlags(&isDormant[i])), ones);
+        __m256i oldFacing = loadFlags(&facingRight[i]);
+        __m256i ex = load(x, i);
+        __m256i left = load(patrolLeft, i);
+        __m256i right = load(patrolRight, i);
+        __m256i range = load(attackRange, i);
+        __m256i oldTimer = load(attackTimer, i);
+        __m256i timer = _mm256_sub_epi64(oldTimer, timeStep);
+
+        // Ranges are below 2^31 raw, so once both offsets are inside the box
+        // their squares fit the 32x32-bit multiply
+        __m256i dx = absolute(_mm256_sub_epi64(px, ex));
+        __m256i dy = absolute(_mm256_sub_epi64(py, load(y, i)));
+        __m256i far = _mm256_or_si256(_mm256_cmpgt_epi64(dx, range), _mm256_cmpgt_epi64(dy, range));
+        __m256i distance = _mm256_add_epi64(_mm256_mul_epu32(dx, dx), _mm256_mul_epu32(dy, dy));
+        __m256i inRange = _mm256_andnot_si256(_mm256_or_si256(far, _mm256_cmpgt_epi64(distance, _mm256_mul_epu32(range, range))), ones);
+        __m256i attack = _mm256_andnot_si256(_mm256_cmpgt_epi64(timer, zero), inRange);
+        __m256i chasing = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi64(left, px), _mm256_cmpgt_epi64(px, right)), ones);
+
+        __m256i toRight = _mm256_cmpgt_epi64(px, ex);
+        __m256i v = select(chasing, select(toRight, chase, chaseBack), select(oldFacing, patrol, patrolBack));
+        __m256i move = select(chasing, select(toRight, chaseMove, chaseBackMove),
+                              select(oldFacing, patrolMove, patrolBackMove));
+        v = _mm256_andnot_si256(inRange, v);
+        move = _mm256_andnot_si256(inRange, move);
+
+        __m256i nx = _mm256_add_epi64(ex, move);
+        __m256i facing = select(_mm256_cmpgt_epi64(v, zero), ones, select(_mm256_cmpgt_epi64(zero, v), zero, oldFacing));
+
+        __m256i atRight = _mm256_andnot_si256(_mm256_cmpgt_epi64(right, nx), ones);
+        __m256i atLeft = _mm256_andnot_si256(atRight, _mm256_andnot_si256(_mm256_cmpgt_epi64(nx, left), ones));
+        nx = select(atRight, right, select(atLeft, left, nx));
+        facing = _mm256_andnot_si256(atRight, _mm256_or_si256(facing, atLeft));
+        timer = select(attack, cooldown, timer);
+
+        store(x, i, select(alive, nx, ex));
+        store(vx, i, select(alive, v, load(vx, i)));
+        store(attackTimer, i, select(alive, timer, oldTimer));
+        storeFlags(&facingRight[i], select(alive, facing, oldFacing));
+        storeFlags(&isAttacking[i], select(alive, attack, loadFlags(&isAttacking[i])));
+    }
+    return count;
+}
+#else
+int EnemyPool::stepBatch(float, sf::Vector2f) {
+    return 0;
+}
+#endif
+
+void EnemyPool::update(float dt, Player& player, const sf::FloatRect* awake, int dormantInterval) {
+    // Enemies move in one pass over the whole pool, so that pass is the
+    // zone; one zone per enemy would cost more than the enemy itself
+    PROFILE_ZONE("EnemyPool::update");
+    sf::Vector2f playerPos = player.getPosition();
+
+    if (awake) {
+        // Each tick one enemy in every stride is checked against the awake
+        // area, so dormant ones cost nothing on the ticks in between. A
+        // dormant enemy that is due first catches up on the ticks since it
+        // last moved, unless dormant enemies are meant to keep still.
+        int stride = std::max(dormantInterval, 1);
+        for (int i = tickCount % stride; i < size(); i += stride) {
+            if (isDead[i]) continue;
+            bool woke = isDormant[i] && dormantInterval > 0;
+            if (woke) {
+                stepScalar(i, i + 1, static_cast<float>(clock - steppedAt[i]), playerPos, true);
             }
-            else if (vy < 0 && playerBounds.top < platform.top + platform.height) {
-                sprite.setPosition(sprite.getPosition().x, platform.top + platform.height);
-                vy = 0;
+            steppedAt[i] = clock;
+            isDormant[i] = !awake->intersects(getBounds(i));
+            // An attack left over from its last awake tick was already dealt
+            if (isDormant[i] && !woke) isAttacking[i] = 0;
+        }
+    } else {
+        std::fill(isDormant.begin(), isDormant.end(), 0);
+    }
+    clock += dt;
+    tickCount++;
+
+    // Awake enemies all move in one pass; dormant ones are skipped by it
+    int done = useBatch ? stepBatch(dt, playerPos) : 0;
+    stepScalar(done, size(), dt, playerPos);
+
+    // Everything that has side effects runs one enemy at a time, in order
+    bool faded = false;
+    for (int i = 0; i < size(); i++) {
+        if (isDead[i]) {
+            if (despawnTimer[i] > 0) despawnTimer[i] -= dt;
+            if (despawnTimer[i] <= 0) faded = true;
+            continue;
+        }
+        if (isDormant[i] && !isAttacking[i]) continue;
+
+        if (isAttacking[i]) {
+            player.health -= damage[i];
+            if (player.health < 0) player.health = 0;
+            LOG(LogInfo, "Player hit! Current health: %d", player.health);
+            // Dormant enemies only attack on the tick they wake
+            if (isDormant[i]) isAttacking[i] = false;
+        }
+
+        if (colorTimer[i] > 0.f) {
+            colorTimer[i] -= dt;
+            if (colorTimer[i] <= 0) {
+                colorTimer[i] = 0;
+                color[i] = sf::Color::White;
             }
-            break;
         }
     }
 
-    if (sprite.getPosition().y >= 700.f) respawn();
+    if (faded) {
+        survivors.assign(size(), 1);
+        for (int i = 0; i < size(); i++) {
+            if (isDead[i] && despawnTimer[i] <= 0) survivors[i] = 0;
+        }
+        retain(survivors);
+    }
+}
+
+void EnemyPool::capture(std::vector<EnemyView>& views) const {
+    for (int i = 0; i < size(); i++) {
+        if (!isVisible(i)) continue;
+
+        const SpriteFrame& frame = kindFrames[kind[i]];
+        EnemyView view;
+        view.x = x[i].toFloat();
+        view.y = y[i].toFloat();
+        bool saved = i < (int)previousX.size();
+        view.previousX = saved ? previousX[i] : view.x;
+        view.previousY = saved ? previousY[i] : view.y;
+        view.scale = scale[i];
+        view.width = width[i];
+        view.height = height[i];
+        view.facingRight = facingRight[i];
+        view.color = color[i];
+        view.texture = frame.texture.get();
+        view.rect = frame.rect;
+        views.push_back(view);
+    }
+}
+
+// The ChunkMap class, which indexes a level's platforms and enemies by chunk
+ChunkMap::ChunkMap(float chunkWidth) : chunkWidth(chunkWidth), worldLeft(0.f) {}
+
+void ChunkMap::build(const Level& level, const std::vector<int>& platformKinds, const std::vector<SpriteFrame>& platformFrames) {
+    worldLeft = level.worldLeft;
+    int chunkCount = std::max(1, static_cast<int>(std::ceil((level.worldRight - level.worldLeft) / chunkWidth)));
+
+    platforms.assign(chunkCount, std::vector<int>());
+    enemies.assign(chunkCount, std::vector<int>());
+    platformBounds.clear();
+    enemyChunks.clear();
+
+    for (int i = 0; i < level.platformCount; i++) {
+        const PlatformSpawn& spawn = level.platforms[i];
+        const sf::IntRect& rect = platformFrames[platformKinds[i]].rect;
+        platformBounds.push_back(sf::FloatRect(spawn.x, spawn.y, rect.width, rect.height));
+        platforms[chunkAt(spawn.x)].push_back(i);
+    }
+    for (int i = 0; i < level.enemyCount; i++) {
+        // Enemies snap into their patrol range on their first tick
+        const EnemySpawn& spawn = level.enemies[i];
+        int chunk = chunkAt(std::min(std::max(spawn.x, spawn.patrolLeft), spawn.patrolRight));
+        enemies[chunk].push_back(i);
+        enemyChunks.push_back(chunk);
+    }
+}
+
+int ChunkMap::count() const {
+    return platforms.size();
+}
+
+int ChunkMap::chunkAt(float x) const {
+    int chunk = static_cast<int>(std::floor((x - worldLeft) / chunkWidth));
+    return std::min(std::max(chunk, 0), count() - 1);
+}
+
+const std::vector<int>& ChunkMap::getPlatforms(int chunk) const {
+    return platforms[chunk];
+}
+
+const std::vector<int>& ChunkMap::getEnemies(int chunk) const {
+    return enemies[chunk];
+}
+
+int ChunkMap::getEnemyChunk(int enemy) const {
+    return enemyChunks[enemy];
+}
+
+const sf::FloatRect& ChunkMap::getPlatformBounds(int platform) const {
+    return platformBounds[platform];
+}
+
+Platform::Platform(const std::string& frameName, float x, float y)
+{
+    frame = AssetManager::getFrame(frameName);
+    frame.apply(sprite);
+    sprite.setPosition(x, y);
+}
+
+void Platform::draw(SpriteBatch& batch) const
+{
+    batch.add(sprite);
+}
+
+SpriteBatch::Quad Platform::getQuad() const
+{
+    return SpriteBatch::makeQuad(sprite);
+}
+
+sf::FloatRect Platform::getBounds() const
+{
+    return sprite.getGlobalBounds();
+}
+
+// The Level class, which reads level files
+Level::Level() : worldLeft(0.f), worldRight(0.f), platforms(nullptr), platformCount(0),
+    enemies(nullptr), enemyCount(0), mapping(nullptr), mappingSize(0) {}
+
+Level::~Level() {
+    unload();
+}
+
+void Level::unload() {
+#if !defined(_WIN32)
+    if (mapping) munmap(mapping, mappingSize);
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+    buffer.clear();
+    platforms = nullptr;
+    enemies = nullptr;
+    platformCount = 0;
+    enemyCount = 0;
+}
+
+// Points the level at compiled data after checking that it is complete
+bool Level::use(const char* data, size_t size) {
+    if (size < sizeof(LevelHeader)) return false;
+
+    const LevelHeader* header = reinterpret_cast<const LevelHeader*>(data);
+    size_t expected = sizeof(LevelHeader) + header->platformCount * sizeof(PlatformSpawn)
+        + header->enemyCount * sizeof(EnemySpawn);
+    if (std::memcmp(header->magic, "LVL1", 4) != 0 || size < expected) return false;
+
+    const PlatformSpawn* platformData = reinterpret_cast<const PlatformSpawn*>(data + sizeof(LevelHeader));
+    const EnemySpawn* enemyData = reinterpret_cast<const EnemySpawn*>(platformData + header->platformCount);
+
+    // Frame names are used as C strings, so they must be terminated
+    for (uint32_t i = 0; i < header->platformCount; i++) {
+        if (!std::memchr(platformData[i].frame, '\0', sizeof(platformData[i].frame))) return false;
+    }
+    for (uint32_t i = 0; i < header->enemyCount; i++) {
+        if (!std::memchr(enemyData[i].frame, '\0', sizeof(enemyData[i].frame))) return false;
+    }
+
+    worldLeft = header->worldLeft;
+    worldRight = header->worldRight;
+    platformCount = header->platformCount;
+    enemyCount = header->enemyCount;
+    platforms = platformData;
+    enemies = enemyData;
+    return true;
+}
 
-    if (isAttacking) {
-        attackDuration -= dt;
-        if (attackDuration <= 0.f) {
-            isAttacking = false;
+bool Level::load(const std::string& name) {
+    unload();
+
+    std::string binaryFile = name + ".lvl";
+#if !defined(_WIN32)
+    int fd = open(binaryFile.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                mapping = data;
+                mappingSize = info.st_size;
+            }
         }
-    }
+        close(fd);
 
-    if (attackCooldown > 0.f) {
-        attackCooldown -= dt;
-        if (attackCooldown < 0.f) attackCooldown = 0.f;
+        if (mapping && use(static_cast<const char*>(mapping), mappingSize)) return true;
+        std::cout << "Ignoring invalid level: " << binaryFile << std::endl;
+        unload();
     }
+#else
+    std::ifstream file(binaryFile, std::ios::binary);
+    if (file) {
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (use(buffer.data(), buffer.size())) return true;
+        std::cout << "Ignoring invalid level: " << binaryFile << std::endl;
+        unload();
+    }
+#endif
 
-}
+    if (parse(name + ".txt", buffer) && use(buffer.data(), buffer.size())) return true;
 
+    std::cout << "Failed to load level: " << name << std::endl;
+    unload();
+    return false;
+}
 
-void Player::draw(sf::RenderWindow& window)
-{
-    window.draw(sprite);
+// Turns the text form of a level into the compiled layout
+bool Level::parse(const std::string& textFile, std::vector<char>& data) {
+    std::ifstream file(textFile);
+    if (!file) return false;
+
+    LevelHeader header = {};
+    std::memcpy(header.magic, "LVL1", 4);
+    std::vector<PlatformSpawn> platforms;
+    std::vector<EnemySpawn> enemies;
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream in(line);
+        std::string kind, frame;
+        if (!(in >> kind) || kind[0] == '#') continue;
+
+        bool ok = false;
+        if (kind == "world") {
+            ok = static_cast<bool>(in >> header.worldLeft >> header.worldRight);
+        } else if (kind == "platform") {
+            PlatformSpawn platform = {};
+            ok = static_cast<bool>(in >> frame >> platform.x >> platform.y);
+            std::strncpy(platform.frame, frame.c_str(), sizeof(platform.frame) - 1);
+            platforms.push_back(platform);
+        } else if (kind == "enemy") {
+            EnemySpawn enemy = {};
+            ok = static_cast<bool>(in >> frame >> enemy.x >> enemy.y >> enemy.patrolLeft >> enemy.patrolRight
+                >> enemy.scale >> enemy.health >> enemy.damage >> enemy.attackRange);
+            std::strncpy(enemy.frame, frame.c_str(), sizeof(enemy.frame) - 1);
+            enemies.push_back(enemy);
+        }
 
-    if (isAttacking) {
-        sf::FloatRect hb = getAttackHitbox();
-        if (facingRight) {
-            attackSprite.setPosition(hb.left, hb.top + 50);
-            attackSprite.setScale(1.0f, 1.0f); 
-            window.draw(attackSprite);
-        } else {
-            attackSprite.setPosition(hb.left + 40, hb.top + 50);
-            attackSprite.setScale(-1.0f, 1.0f); 
-            window.draw(attackSprite);
+        if (!ok || frame.size() >= sizeof(PlatformSpawn::frame)) {
+            std::cout << textFile << ":" << lineNumber << ": bad level line: " << line << std::endl;
+            return false;
         }
     }
+
+    header.platformCount = platforms.size();
+    header.enemyCount = enemies.size();
+
+    data.resize(sizeof(header) + platforms.size() * sizeof(PlatformSpawn) + enemies.size() * sizeof(EnemySpawn));
+    char* out = data.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    if (!platforms.empty()) std::memcpy(out, platforms.data(), platforms.size() * sizeof(PlatformSpawn));
+    out += platforms.size() * sizeof(PlatformSpawn);
+    if (!enemies.empty()) std::memcpy(out, enemies.data(), enemies.size() * sizeof(EnemySpawn));
+    return true;
 }
 
-void Player::gainSoul(int amount) {
-    soul += amount;
-    if (soul > maxSoul) soul = maxSoul;
+bool Level::compile(const std::string& textFile, const std::string& binaryFile) {
+    std::vector<char> data;
+    if (!parse(textFile, data)) return false;
+
+    std::ofstream file(binaryFile, std::ios::binary);
+    file.write(data.data(), data.size());
+    return static_cast<bool>(file);
 }
 
-void Player::heal() {
-    if (soul >= 5 && health != 100) { 
-        health += 10;
-        if (health > 100) health = 100;
-        soul -= 5;
+// The FixedStepper class, which schedules the simulation's fixed ticks
+FixedStepper::FixedStepper(float step, int maxSteps)
+    : step(step), maxSteps(maxSteps), accumulated(0.f), debt(0.f),
+      budget(step / 2.f), averageCost(0.f), degradable(false), degraded(false) {}
+
+int FixedStepper::advance(float elapsed) {
+    accumulated += elapsed;
+    int steps = static_cast<int>(accumulated / step);
+
+    bool dropped = false;
+    if (steps > maxSteps) {
+        float late = (steps - maxSteps) * step;
+        accumulated -= late;
+        debt += late;
+        steps = maxSteps;
+        dropped = true;
     }
+    accumulated -= steps * step;
+
+    degraded = degradable && (dropped || averageCost > budget);
+    return steps;
 }
 
-void Player::setColor(const sf::Color& color) {
-    sprite.setColor(color);
+void FixedStepper::recordTick(float seconds) {
+    averageCost += (seconds - averageCost) * 0.1f;
+}
+
+void FixedStepper::setBudget(float seconds) {
+    budget = seconds;
 }
 
-Enemy::Enemy(float startX, float startY, float leftBound, float rightBound, string filename, float scale, int healthAmount, int damageAmount,
-    float atr) {
-    texture.loadFromFile(filename);
-    sprite.setTexture(texture);
+void FixedStepper::setDegradable(bool enabled) {
+    degradable = enabled;
+    if (!enabled) degraded = false;
+}
 
-    sprite.setPosition(startX, startY);
-    sprite.setScale(scale, scale);
+bool FixedStepper::isDegraded() const {
+    return degraded;
+}
 
-    attackRange = atr;
-    chaseSpeed = 200.f;
-    attackCooldown = 1.f; 
-    attackTimer = 0.f;   
+float FixedStepper::getStep() const {
+    return step;
+}
 
-    vx = 100.f;
+float FixedStepper::getRemainder() const {
+    return accumulated;
+}
 
-    facingRight = true;
+float FixedStepper::getDebt() const {
+    return debt;
+}
 
-    patrolLeft = leftBound;
-    patrolRight = rightBound;
-    patrolSpeed = 150.f;
-    this->scale = scale;
-    health = healthAmount;
-    this->damage = damageAmount;
-    isDead = false;
-    despawnTimer = 1.f;
-    colorTimer = 0.f;
+float FixedStepper::getAverageCost() const {
+    return averageCost;
 }
 
-// float Enemy::distanceToPlayer(const Player& player) {
-//     return std::abs(player.getPosition().x - sprite.getPosition().x);
-// }
+const char* Game::traceFile = "trace.json";
+
+// Headless games load everything up front. A window only waits for what the
+// menu shows; the rest is decoded behind it and uploaded as it arrives.
+static std::vector<std::shared_ptr<sf::Image>> loadStartupImages(bool headless)
+{
+    std::vector<std::string> files = AssetManager::startupFiles();
+    if (headless) return AssetManager::preload(files);
 
-void Enemy::reset(float startX, float startY, int hlt) {
-    isDead = false;
-    despawnTimer = 1.f;  // Reset to initial value
-    sprite.setPosition(startX, startY);
-    health = hlt;  // Actually set the health!
-    attackTimer = 0.f;  // Reset attack timer
-    colorTimer = 0.f;   // Reset color timer
-    setColor(sf::Color::White);  // Reset color
+    std::vector<std::string> menu = AssetManager::menuFiles();
+    std::vector<std::string> gameplay;
+    for (const std::string& file : files) {
+        if (std::find(menu.begin(), menu.end(), file) == menu.end()) gameplay.push_back(file);
+    }
+    AssetManager::stream(gameplay);
+    return AssetManager::preload(menu);
 }
 
-float Enemy::distanceToPlayer(Player& player) {
-    sf::Vector2f p = player.getPosition();
-    sf::Vector2f e = sprite.getPosition();
+// The SnapshotBuffer class. The simulation owns writeIndex, the renderer owns
+// readIndex and the third slot is parked in shared, tagged with fresh when it
+// holds a snapshot the renderer has not taken yet.
+SnapshotBuffer::SnapshotBuffer() : writeIndex(0), readIndex(1), shared(2) {}
 
-    float dx = p.x - e.x;
-    float dy = p.y - e.y;
+FrameSnapshot& SnapshotBuffer::writeSlot() {
+    return slots[writeIndex];
+}
 
-    return std::sqrt(dx * dx + dy * dy);
+void SnapshotBuffer::publish() {
+    int previous = shared.exchange(writeIndex | fresh, std::memory_order_acq_rel);
+    writeIndex = previous & 3;
 }
 
+bool SnapshotBuffer::acquire() {
+    if (!(shared.load(std::memory_order_relaxed) & fresh)) return false;
+    int previous = shared.exchange(readIndex, std::memory_order_acq_rel);
+    readIndex = previous & 3;
+    return true;
+}
 
-void Enemy::setColor(const sf::Color& color) {
-    sprite.setColor(color);
+const FrameSnapshot& SnapshotBuffer::readSlot() const {
+    return slots[readIndex];
 }
 
-void Enemy::setPlayer(Player* player) {
-    targetPlayer = player;
+Game::Game(bool headlessMode, const std::string& levelName)
+    : headless(AssetManager::setHeadless(headlessMode)),
+      startupImages(loadStartupImages(headless)),
+      input(&keyboard),
+      recorder(nullptr),
+      previousKeys(0),
+      stepper(tickLength),
+      degraded(false),
+      assetsReady(headless),
+      startRequested(false),
+      running(false),
+      quitRequested(false),
+      showFrameGraph(false),
+      profiled(false),
+      background("PNGS/bgimg.png"),
+      mainmenu("PNGS/mainmenu.png"),
+      hudHealth(player.maxHealth),
+      hudSoul(0),
+      healthBar(&hudHealth, player.maxHealth),
+      soulBar(&hudSoul)
+
+{
+    state = 0;
+    option = 0;
+    chunkRadius = 1;
+    tuning = EnemyTuning{ 1.f, 1.f, 1.f };
+    renderStats = RenderStats{ 0, 0, 0 };
+
+    loadLevel(levelName);
+    titleFrame = AssetManager::getFrame("title");
+    titleFrame.apply(titleSprite);
+    titleSprite.setPosition(0, 0);
+    
+    if (headless) {
+        // Same view as a 1920x1080 desktop would get
+        viewSize = sf::Vector2f(1536.f, 864.f);
+    } else {
+        sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
+        unsigned int width  = desktop.width  * 0.8f;
+        unsigned int height = desktop.height * 0.8f;
+
+        window.create(sf::VideoMode(width, height), "Hollow Knight Inspired Game");
+        // Frames follow the display's refresh; interpolation keeps them
+        // smooth between the 60 Hz ticks
+        window.setVerticalSyncEnabled(true);
+        viewSize = sf::Vector2f(window.getSize().x, window.getSize().y);
+
+        buildMenuText();
+
+        hudTexture.create(window.getSize().x, window.getSize().y);
+        hudSprite.setTexture(hudTexture.getTexture(), true);
+    }
+
+    camera.setSize(viewSize);
+    camera.setCenter(player.getPosition());
+    savePreviousState();
+    saveState(startState);
+
+    // Every texture is uploaded by now, so the decoded copies can go
+    startupImages.clear();
 }
 
-void Enemy::update(float dt, sf::FloatRect platformBounds[]) {
-    if (!targetPlayer) return;
-    if (isDead) {
-        if (despawnTimer > 0) despawnTimer -= dt;
-        if (despawnTimer <= 0) {
-            sprite.setPosition(-9999, -9999); 
-        }
-        return;
+
+void Game::buildMenuText()
+{
+    font = AssetManager::getFont("arial.ttf");
+
+    const char* labels[2] = { "Start Game", "Quit Game" };
+    sf::Vector2f positions[2] = { sf::Vector2f(700, 400), sf::Vector2f(705, 470) };
+
+    for (int i = 0; i < 2; i++) {
+        menuOptions[i] = sf::Text(labels[i], *font, 32);
+        menuOptions[i].setFillColor(sf::Color(200,200,200));
+        menuOptions[i].setPosition(positions[i]);
+
+        // Measuring the text also rasterizes its glyphs, so the first
+        // rendered frame finds them already in the font's cache
+        sf::FloatRect bounds = menuOptions[i].getGlobalBounds();
+        menuBoxes[i].setSize(sf::Vector2f(bounds.width + 20, bounds.height + 10));
+        menuBoxes[i].setPosition(bounds.left - 10, bounds.top - 5);
+        menuBoxes[i].setFillColor(sf::Color::Transparent);
+        menuBoxes[i].setOutlineColor(sf::Color::White);
+        menuBoxes[i].setOutlineThickness(2);
     }
 
-    attackTimer -= dt;
-    isAttacking = false;
-    sf::Vector2f pos = sprite.getPosition();
-    sf::Vector2f playerPos = targetPlayer->getPosition();
-    // float dist = std::abs(playerPos.x - pos.x);
-    float dx = playerPos.x - pos.x;
-    float dy = playerPos.y + 80.f - pos.y;
-    float dist = std::sqrt(dx * dx + dy * dy);
-    // std::cout << dist << std::endl;
-    float vx = 0.f;
-    if (dist <= attackRange) {
-        vx = 0.f;
-        if (attackTimer <= 0.f) {
-            isAttacking = true;
-            attackTimer = attackCooldown;
-            targetPlayer->health -= this->damage;
-            if (targetPlayer->health < 0) targetPlayer->health = 0;
-            std::cout << "Player hit! Current health: " << targetPlayer->health << std::endl;
-        }
-    } else if (playerPos.x >= patrolLeft && playerPos.x <= patrolRight) {
-        vx = (playerPos.x > pos.x) ? chaseSpeed : -chaseSpeed;
-    } else {
-        vx = (facingRight) ? patrolSpeed : -patrolSpeed;
+    endText = sf::Text("GAME OVER", *font, 64);
+    endText.setFillColor(sf::Color::Red);
+    endText.setPosition(600, 200);
+    endText.getGlobalBounds();
+
+    endInfo = sf::Text("Press ENTER to return to Main Menu", *font, 32);
+    endInfo.setFillColor(sf::Color::White);
+    endInfo.setPosition(520, 400);
+    endInfo.getGlobalBounds();
+
+    loadingText = sf::Text("Loading...", *font, 24);
+    loadingText.setFillColor(sf::Color(200,200,200));
+    loadingText.setPosition(705, 540);
+    loadingText.getGlobalBounds();
+}
+
+void Game::run()
+{
+    // The first frame is published before the simulation thread exists
+    publishSnapshot(0.f);
+    snapshots.acquire();
+
+    running = true;
+    std::thread simulation(&Game::simulate, this);
+    Profiler::instance().nameThread("render");
+    sf::Clock frameClock;
+
+    while (window.isOpen()) {
+        frameGraph.record(frameClock.restart().asSeconds() * 1000.f);
+        if (!assetsReady && AssetManager::updateStreaming()) assetsReady = true;
+        processEvents();
+        keyboard.refresh();
+        if (quitRequested) window.close();
+        if (!window.isOpen()) break;
+
+        // Without a new snapshot the previous one is drawn again
+        snapshots.acquire();
+        render(snapshots.readSlot());
     }
 
-    sprite.move(vx * dt, 0.f);
+    running = false;
+    simulation.join();
 
-    if (vx > 0.f) facingRight = true;
-    else if (vx < 0.f) facingRight = false;
+    if (profiled) Profiler::instance().writeTrace(traceFile);
+}
 
-    sprite.setScale(facingRight ? scale : -scale, scale);
-    sprite.setOrigin(facingRight ? 0.f : texture.getSize().x, 0.f);
+// The simulation thread: fixed steps on its own clock, one snapshot for
+// every batch of steps
+void Game::simulate()
+{
+    stepper.setDegradable(!recorder);
+    Profiler::instance().nameThread("simulation");
+    sf::Clock clock;
 
-    if (sprite.getPosition().x >= patrolRight) {
-        sprite.setPosition(patrolRight, pos.y);
-        facingRight = false;
-    } else if (sprite.getPosition().x <= patrolLeft) {
-        sprite.setPosition(patrolLeft, pos.y);
-        facingRight = true;
+    while (running) {
+        if (advance(clock.restart().asSeconds()) > 0) publishSnapshot(stepper.getRemainder());
+        sf::sleep(sf::seconds(tickLength - stepper.getRemainder()));
     }
+}
 
-    if (colorTimer > 0.f) {
-        colorTimer -= dt;
-        if (colorTimer <= 0) {
-            colorTimer = 0;
-            setColor(sf::Color::White);
-        }
+int Game::advance(float elapsed)
+{
+    int steps = stepper.advance(elapsed);
+    degraded = stepper.isDegraded();
+
+    sf::Clock cost;
+    for (int i = 0; i < steps; i++) {
+        // Only the last tick of a batch is interpolated from
+        if (!headless && i == steps - 1) savePreviousState();
+
+        cost.restart();
+        tick(tickLength);
+        stepper.recordTick(cost.getElapsedTime().asSeconds());
     }
+    return steps;
 }
 
-void Enemy::draw(sf::RenderWindow& window) {
-    window.draw(sprite);
+FixedStepper& Game::getStepper()
+{
+    return stepper;
+}
+
+void Game::savePreviousState()
+{
+    previousCamera = camera.getCenter();
+    previousPlayer = player.getPosition();
+    enemies.savePositions();
 }
 
-Platform::Platform(const std::string& filename, float x, float y)
+void Game::publishSnapshot(float remainder)
 {
-    sf::Image fullImage;
-    if (!fullImage.loadFromFile("PNGS/platform.png"))
-        std::cout << "Failed to load platform sprite!\n";
+    PROFILE_ZONE("publishSnapshot");
+    FrameSnapshot& frame = snapshots.writeSlot();
+    frame.state = state;
+    frame.option = option;
+    frame.cameraCenter = camera.getCenter();
+    frame.previousCameraCenter = previousCamera;
+    frame.player = player.getView();
+    frame.previousPlayerPosition = previousPlayer;
+    frame.health = player.health;
+    frame.soul = player.soul;
+    frame.degraded = degraded;
+    frame.chunkBegin = loadedBegin;
+    frame.chunkEnd = loadedEnd;
+    frame.loading = startRequested && !assetsReady;
+
+    // clear() keeps the capacity, so steady state does not allocate
+    frame.enemies.clear();
+    enemies.capture(frame.enemies);
+
+    frame.remainder = remainder;
+    frame.publishedAt = std::chrono::steady_clock::now();
+    snapshots.publish();
+}
 
-    sf::IntRect frameRect(0, 330, 310, 160);
-    sf::Image frameImage;
-    frameImage.create(frameRect.width, frameRect.height);
-    frameImage.copy(fullImage, 0, 0, frameRect, false);
+void Game::loadLevel(const std::string& name)
+{
+    level.load(name);
 
-    if (!texture.loadFromImage(frameImage))
-        std::cout << "Failed to create platform texture!\n";
+    // Every frame the level uses is resolved now, on the loading thread
+    for (int i = 0; i < level.enemyCount; i++) {
+        enemies.findKind(level.enemies[i].frame);
+    }
+    platformKinds.clear();
+    for (int i = 0; i < level.platformCount; i++) {
+        platformKinds.push_back(findPlatformKind(level.platforms[i].frame));
+    }
+    chunks.build(level, platformKinds, platformFrames);
+
+    defeated.assign(level.enemyCount, 0);
+    defeatedCount = 0;
+    enemies.clear();
+    loadedBegin = loadedEnd = 0;
+    renderBegin = renderEnd = -1;
+    streamChunks();
+}
 
-    sprite.setTexture(texture);
-    sprite.setPosition(x, y);
+int Game::findPlatformKind(const std::string& frameName)
+{
+    for (int k = 0; k < (int)platformKindNames.size(); k++) {
+        if (platformKindNames[k] == frameName) return k;
+    }
+    platformKindNames.push_back(frameName);
+    platformFrames.push_back(AssetManager::getFrame(frameName));
+    return platformKindNames.size() - 1;
 }
 
-void Platform::draw(sf::RenderWindow& window)
+void Game::setChunkRadius(int radius)
 {
-    window.draw(sprite);
+    chunkRadius = std::max(radius, 0);
+    streamChunks();
 }
 
-sf::FloatRect Platform::getBounds() const
+// Loads the chunks around the camera and unloads the rest; nothing happens
+// while the camera stays in the same chunk
+void Game::streamChunks()
 {
-    return sprite.getGlobalBounds();
+    int center = chunks.chunkAt(camera.getCenter().x);
+    int begin = std::max(center - chunkRadius, 0);
+    int end = std::min(center + chunkRadius + 1, chunks.count());
+    if (begin == loadedBegin && end == loadedEnd) return;
+
+    keepEnemies.assign(enemies.size(), 1);
+    for (int i = 0; i < enemies.size(); i++) {
+        int chunk = chunks.getEnemyChunk(enemies.id[i]);
+        if (chunk < begin || chunk >= end) keepEnemies[i] = 0;
+    }
+    enemies.retain(keepEnemies);
+
+    for (int chunk = begin; chunk < end; chunk++) {
+        if (chunk >= loadedBegin && chunk < loadedEnd) continue;
+        for (int index : chunks.getEnemies(chunk)) {
+            if (defeated[index]) continue;
+            EnemySpawn spawn = level.enemies[index];
+            spawn.health = static_cast<int32_t>(spawn.health * tuning.health);
+            spawn.damage = static_cast<int32_t>(spawn.damage * tuning.damage);
+            spawn.attackRange *= tuning.attackRange;
+            enemies.spawn(spawn, index);
+        }
+    }
+
+    loadedBegin = begin;
+    loadedEnd = end;
+    buildPlatformGrid();
 }
 
-Game::Game()
-    : background("PNGS/bgimg.png"),
-      mainmenu("PNGS/mainmenu.png"),
-      platform1("PNGS/platform.png", -20.f, 750.f),
-      platform2("PNGS/platform.png", 255.f, 750.f),
-      platform3("PNGS/platform.png", 530.f, 750.f),
-      platform4("PNGS/platform.png", 705.f, 750.f),
-      platform5("PNGS/platform.png", 980.f, 750.f),
-      platform6("PNGS/platform.png", 1255.f, 750.f),
-      platform7("PNGS/platform.png", 1850.f, 750.f),
-      platform8("PNGS/platform.png", 2250.f, 600.f),
-      platform9("PNGS/platform.png", 2150.f, 275.f),
-      Platform10("PNGS/platform.png", 2850.f, 750.f),
-      Platform11("PNGS/platform.png", 3150.f, 750.f),
-      Platform12("PNGS/platform.png", 2650.f, 420.f),
-      Platform13("PNGS/platform.png", 2950.f, 420.f),
-      Platform14("PNGS/platform.png", 3450.f, 575.f),
-      Platform15("PNGS/platform.png", 1850.f, 275.f),
-      Platform16("PNGS/platform.png", 1600.f, 275.f),
-      Platform17("PNGS/platform.png", 1100.f, 275.f),
-      Platform18("PNGS/platform.png", 850.f, 275.f),
-      Platform19("PNGS/platform.png", 550.f, 275.f),
-      Platform20("PNGS/platform.png", 250.f, 275.f),
-      healthBar(&player.health, player.maxHealth),
-      soulBar(&player.soul),
-      enemy1(600.f, 725.f, 500.f, 750.f, "PNGS/enemy2.png", 0.75f, 50, 15 , 30.f),
-      enemy2(600.f, 725.f, 900.f, 1150.f, "PNGS/enemy2.png", 0.75f, 50, 15 , 30.f),
-      enemy3(600.f, 725.f, 2900.f, 3200.f, "PNGS/Deephunter.png", 0.75f, 70, 15 , 30.f),
-      enemy4(240.f, 365.f, 2700.f, 3000.f, "PNGS/shadowcreeper.png", 0.75f, 100, 20 , 30.f),
-      enemy5(100.f, 225.f, 1700.f, 2200.f, "PNGS/shadowcreeper.png", 0.75f, 100, 20 , 30.f),
-      enemy6(20.f, 125.f, 250.f, 1200.f, "PNGS/mosscharger.png", 0.75f, 300, 40 , 120.f)
+void Game::buildPlatformGrid()
+{
+    // Platforms go into the grid in chunk order, the order the renderer
+    // builds its quads in
+    platformGrid.clear();
+    for (int chunk = loadedBegin; chunk < loadedEnd; chunk++) {
+        for (int index : chunks.getPlatforms(chunk)) {
+            platformGrid.insert(chunks.getPlatformBounds(index));
+        }
+    }
+}
 
+void Game::saveState(std::vector<unsigned char>& out) const
 {
-    state = 0;
-    option = 0;
-    sf::Image fullImage;
-    if (!fullImage.loadFromFile("PNGS/title.png"))
-        std::cout << "Failed to load platform sprite!\n";
+    GameState saved = {};
+    saved.state = state;
+    saved.option = option;
+    saved.startRequested = startRequested;
+    saved.previousKeys = previousKeys;
+    saved.cameraX = camera.getCenter().x;
+    saved.cameraY = camera.getCenter().y;
+    saved.loadedBegin = loadedBegin;
+    saved.loadedEnd = loadedEnd;
+    saved.levelEnemies = level.enemyCount;
+    saved.defeatedCount = defeatedCount;
+    saved.player = player.saveState();
+
+    out.clear();
+    appendBytes(out, &saved, 1);
+    enemies.save(out);
+    appendBytes(out, defeated.data(), defeated.size());
+}
 
-    sf::IntRect frameRect(0, 0, 1328, 275);
-    sf::Image frameImage;
-    frameImage.create(frameRect.width, frameRect.height);
-    frameImage.copy(fullImage, 0, 0, frameRect, false);
+bool Game::restoreState(const std::vector<unsigned char>& in)
+{
+    // Snapshots may come from a file or a fuzzer: check everything before
+    // any of the game changes
+    GameState saved;
+    if (in.size() < sizeof(saved) + defeated.size()) return false;
+    const unsigned char* cursor = readBytes(in.data(), &saved, 1);
+    const unsigned char* enemiesEnd = in.data() + in.size() - defeated.size();
+    if (saved.levelEnemies != level.enemyCount) return false;
+    if (saved.state < 0 || saved.state > 2 || saved.option < 0 || saved.option > 1) return false;
+    if (saved.loadedBegin < 0 || saved.loadedBegin > saved.loadedEnd || saved.loadedEnd > chunks.count()) return false;
+    if (!enemies.restore(cursor, enemiesEnd, level.enemyCount)) return false;
+    readBytes(enemiesEnd, defeated.data(), defeated.size());
+
+    state = saved.state;
+    option = saved.option;
+    startRequested = saved.startRequested;
+    previousKeys = saved.previousKeys;
+    camera.setCenter(saved.cameraX, saved.cameraY);
+    defeatedCount = saved.defeatedCount;
+    player.restoreState(saved.player);
+
+    if (saved.loadedBegin != loadedBegin || saved.loadedEnd != loadedEnd) {
+        loadedBegin = saved.loadedBegin;
+        loadedEnd = saved.loadedEnd;
+        buildPlatformGrid();
+    }
 
-    if (!titleTexture.loadFromImage(frameImage))
-        std::cout << "Failed to create platform texture!\n";
+    // Nothing slides across the screen from where it was before
+    savePreviousState();
+    return true;
+}
 
-    titleSprite.setTexture(titleTexture);
-    titleSprite.setPosition(0, 0);
-    
-    sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
-    unsigned int width  = desktop.width  * 0.8f;
-    unsigned int height = desktop.height * 0.8f;
+void Game::resetGame()
+{
+    // Back to how the game stood once constructed. The held keys are input
+    // rather than game state: restoring them would count the Enter that
+    // asked for the reset as pressed again.
+    unsigned keys = previousKeys;
+    restoreState(startState);
+    previousKeys = keys;
+}
 
-    window.create(sf::VideoMode(width, height), "Hollow Knight Inspired Game");
-    window.setFramerateLimit(60);
+const RenderStats& Game::getRenderStats() const
+{
+    return renderStats;
+}
 
-    camera.setSize(window.getSize().x, window.getSize().y);
-    camera.setCenter(player.getPosition());
+sf::Vector2f Game::getPlayerPosition() const
+{
+    return player.getPosition();
+}
 
+int Game::getState() const
+{
+    return state;
+}
 
-    enemy1.setPlayer(&player);
-    enemy2.setPlayer(&player);
-    enemy3.setPlayer(&player);
-    enemy4.setPlayer(&player);
-    enemy5.setPlayer(&player);
-    enemy6.setPlayer(&player);
+int Game::getPlayerHealth() const
+{
+    return player.health;
 }
 
+int Game::getDefeatedCount() const
+{
+    return defeatedCount;
+}
 
-void Game::run()
+int Game::getEnemyTotal() const
 {
-    sf::Clock clock;
-    const float targetFrameTime = 1.0f / 60.0f;
-    float accumulatedTime = 0.0f;
-    
-    while (window.isOpen()) {
-        float dt = clock.restart().asSeconds();
-        accumulatedTime += dt;
-        processEvents();
-        while (accumulatedTime >= targetFrameTime) {
-            update(targetFrameTime);
-            accumulatedTime -= targetFrameTime;
-        }
-        render();
+    return level.enemyCount;
+}
+
+void Game::setEnemyTuning(const EnemyTuning& enemyTuning)
+{
+    tuning = enemyTuning;
+    enemies.clear();
+    loadedBegin = loadedEnd = 0;
+    streamChunks();
+    saveState(startState);
+}
+
+void Game::setInput(InputSource* source)
+{
+    input = source ? source : &keyboard;
+}
+
+void Game::setRecorder(InputRecorder* source)
+{
+    recorder = source;
+    if (recorder) {
+        setDeterministic(true);
+        stepper.setDegradable(false);
     }
 }
 
-void Game::resetGame()
+void Game::setViewSize(sf::Vector2f size)
 {
-    // Reset player
-    player.sprite.setPosition(100.f, 200.f);
-    player.health = player.maxHealth;
-    player.soul = 0;
-    player.vx = 0;
-    player.vy = 0;
-    player.onGround = false;
-    player.facingRight = true;
-    player.isAttacking = false;
-    player.attackDuration = 0.f;
-    player.attackCooldown = 0.f;
-    player.attacked = true;
-
-    // Reset enemies with correct positions and health
-    enemy1.reset(600.f, 725.f, 50);
-    enemy2.reset(900.f, 725.f, 50);    // Fixed position
-    enemy3.reset(2900.f, 725.f, 70);   // Fixed position
-    enemy4.reset(2700.f, 365.f, 100);  // Fixed position
-    enemy5.reset(1700.f, 225.f, 100);  // Fixed position
-    enemy6.reset(250.f, 125.f, 300);   // Fixed position
+    viewSize = size;
+    camera.setSize(viewSize);
+}
 
-    healthBar.update();
-    soulBar.update();
-    camera.setCenter(player.getPosition());
+sf::Vector2f Game::getViewSize() const
+{
+    return viewSize;
+}
+
+void Game::setDeterministic(bool enabled)
+{
+    player.setDeterministic(enabled);
+}
+
+uint64_t Game::stateHash() const
+{
+    const int64_t values[] = { state, player.health, player.soul, defeatedCount, enemies.size() };
+    uint64_t hash = hashValues(player.stateHash(), values, 5);
+    for (int i = 0; i < enemies.size(); i++) {
+        const int64_t enemy[] = { enemies.id[i], enemies.health[i], enemies.isDead[i],
+                                  enemies.x[i].raw, enemies.vx[i].raw,
+                                  enemies.attackTimer[i].raw, enemies.facingRight[i] };
+        hash = hashValues(hash, enemy, 7);
+    }
+    return hash;
+}
 
-    state = 1;  // Set to gameplay state
+void Game::tick(float dt)
+{
+    unsigned keys = input->poll();
+    unsigned pressed = 0;
+    int stateBefore = state;
+
+    // A window delivers key presses as events; headless games derive them
+    // from the keys that went down since the last tick. Sources that know
+    // the presses, like a replay, are taken at their word.
+    bool known = input->pollPresses(pressed);
+    if (known || headless) {
+        if (!known) pressed = keys & ~previousKeys;
+        for (unsigned key = 1; key <= KeyEnter; key <<= 1) {
+            if (pressed & key) handlePress(key);
+        }
+    } else {
+        {
+            std::lock_guard<std::mutex> guard(pressLock);
+            if (!pendingPresses.empty()) {
+                pressed = pendingPresses.front();
+                pendingPresses.erase(pendingPresses.begin());
+            }
+        }
+        if (pressed) handlePress(pressed);
+    }
+    previousKeys = keys;
+
+    player.input = keys;
+    update(dt);
+
+    if (recorder) {
+        // A replay never waits for assets, so a start that did is recorded
+        // on the tick the game actually started. The menu ignores presses
+        // while it waits, so those are left out.
+        if (state == 0 && startRequested) pressed = 0;
+        if (stateBefore == 0 && state == 1) pressed = KeyEnter;
+        recorder->record(keys, pressed);
+    }
 }
 
 void Game::processEvents()
 {
+    PROFILE_ZONE("processEvents");
     sf::Event event;
     while (window.pollEvent(event)) {
         if (event.type == sf::Event::Closed)
             window.close();
-        if (state == 0) {
-            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Enter && option == 0) {
-                state = 1;
-                return;
-            } else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Enter && option == 1) {
-                window.close();
-            }
-            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Up or event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Down) {
-                option = (option + 1) % 2;
-            }
-        } else if (state == 1) {
-            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::M) {
-                player.meleeAttack();
-            }
-        } else if (state == 2) {
-            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Enter) {
-                resetGame();
-                state = 0;
-            }
+        if (event.type != sf::Event::KeyPressed)
+            continue;
+
+        if (event.key.code == sf::Keyboard::F3) {
+            showFrameGraph = !showFrameGraph;
+        } else if (event.key.code == sf::Keyboard::F4) {
+            Profiler& profiler = Profiler::instance();
+            profiler.setEnabled(!profiler.isEnabled());
+            profiled = true;
+        }
+
+        // Presses are handled by the simulation thread on its next tick
+        unsigned key = 0;
+        switch (event.key.code) {
+            case sf::Keyboard::Enter: key = KeyEnter; break;
+            case sf::Keyboard::Up:    key = KeyUp; break;
+            case sf::Keyboard::Down:  key = KeyDown; break;
+            case sf::Keyboard::M:     key = KeyAttack; break;
+            default: break;
+        }
+        if (key != 0) {
+            std::lock_guard<std::mutex> guard(pressLock);
+            pendingPresses.push_back(key);
         }
+    }
+}
 
+void Game::handlePress(unsigned key)
+{
+    if (state == 0) {
+        // A start waiting for assets keeps the choice it was made with
+        if (startRequested) return;
+        if (key == KeyEnter && option == 0) {
+            // Started from update() once the last asset is uploaded
+            if (assetsReady) state = 1;
+            else startRequested = true;
+        } else if (key == KeyEnter && option == 1) {
+            quitRequested = true;
+        }
+        if (key == KeyUp || key == KeyDown) {
+            option = (option + 1) % 2;
+        }
+    } else if (state == 1) {
+        if (key == KeyAttack) {
+            player.meleeAttack();
+        }
+    } else if (state == 2) {
+        if (key == KeyEnter) {
+            resetGame();
+            state = 0;
+        }
     }
 }
 
 
 void Game::update(float dt)
 {
+    PROFILE_ZONE("Game::update");
+    if (state == 0 && startRequested && assetsReady) {
+        startRequested = false;
+        state = 1;
+    }
     if (state == 0) return;
     if (state == 2) return;
     if (player.health <= 0) {
         state = 2;
     }
-    if (enemy1.isDead && enemy2.isDead && enemy3.isDead && enemy4.isDead && enemy5.isDead && enemy6.isDead) {
+    if (defeatedCount == level.enemyCount) {
         state = 2;
     }
-    sf::FloatRect platformBounds[] = {
-        platform1.getBounds(),
-        platform2.getBounds(),
-        platform3.getBounds(),
-        platform4.getBounds(),
-        platform5.getBounds(),
-        platform6.getBounds(),
-        platform7.getBounds(),
-        platform8.getBounds(),
-        platform9.getBounds(),
-        Platform10.getBounds(),
-        Platform11.getBounds(),
-        Platform12.getBounds(),
-        Platform13.getBounds(),
-        Platform14.getBounds(),
-        Platform15.getBounds(),
-        Platform16.getBounds(),
-        Platform17.getBounds(),
-        Platform18.getBounds(),
-        Platform19.getBounds(),
-        Platform20.getBounds()
-    };
-    
-    player.update(dt, platformBounds);
-
-    Enemy* enemies[] = {
-        &enemy1, 
-        &enemy2,
-        &enemy3,
-        &enemy4,
-        &enemy5,
-        &enemy6
-        };
+    player.update(dt, platformGrid);
 
-    for (int i = 0; i < 6; i++) {
-        enemies[i]->update(dt, platformBounds);
-    }
+    // Only enemies near the camera think every tick. While the simulation
+    // catches up, the rest keep still instead of waking now and then.
+    sf::Vector2f center = camera.getCenter();
+    sf::FloatRect awake(center.x - viewSize.x, center.y - viewSize.y, viewSize.x * 2.f, viewSize.y * 2.f);
+    enemies.update(dt, player, &awake, degraded ? 0 : dormantInterval);
     
     if (player.isAttacking && !player.attacked) {
+        PROFILE_ZONE("combat");
         sf::FloatRect attackBox = player.getAttackHitbox();
         // std::cout << attackBox.left << " " << attackBox.top << std::endl;
-        for (int j = 0; j < 6; j++) {
-            Enemy& enemy = *enemies[j];
-            if (attackBox.intersects(enemy.getBounds())) {
+        for (int j = 0; j < enemies.size(); j++) {
+            if (attackBox.intersects(enemies.getBounds(j))) {
                 // Deal damage
                 player.attacked = true;
-                enemy.health -= player.damage;  
+                enemies.health[j] -= player.damage;  
                 player.gainSoul(5);
-                if (enemy.health <= 0) {
-                    enemy.health = -1;
-                    enemy.isDead = true;
+                if (enemies.health[j] <= 0) {
+                    enemies.health[j] = -1;
+                    // Enemies can still be hit while they fade out
+                    if (!enemies.isDead[j]) defeatedCount++;
+                    enemies.isDead[j] = true;
+                    defeated[enemies.id[j]] = 1;
                     // enemy.despawnTimer = 1.0f;
-                    enemy.setColor(sf::Color(80, 80, 80));
+                    enemies.color[j] = sf::Color(80, 80, 80);
                 } else {
-                    std::cout << "Enemy hit! Current health: " << enemy.health << std::endl;
-                    enemy.setColor(sf::Color::Red);
-                    enemy.colorTimer = 0.5f;
+                    LOG(LogInfo, "Enemy hit! Current health: %d", enemies.health[j]);
+                    enemies.color[j] = sf::Color::Red;
+                    enemies.colorTimer[j] = 0.5f;
                 }
 
         }
     }
 }
- sf::Vector2f camPos = camera.getCenter();
+    PROFILE_ZONE("camera");
+    sf::Vector2f camPos = camera.getCenter();
     camPos.x = player.getPosition().x;
 
     float smooth = 5.f;
     camPos.x = camera.getCenter().x + (player.getPosition().x - camera.getCenter().x) * dt * smooth;
 
-    camPos.y = window.getSize().y / 2.f;
-    if (camPos.x < window.getSize().x / 2.f)
-        camPos.x = window.getSize().x / 2.f;
+    camPos.y = viewSize.y / 2.f;
+    if (camPos.x < viewSize.x / 2.f)
+        camPos.x = viewSize.x / 2.f;
 
-    float worldLeft  = 0.f;
-    float worldRight = 3800.f;
+    float worldLeft  = level.worldLeft;
+    float worldRight = level.worldRight;
     float halfWidth = camera.getSize().x / 2.f;
 
     if (camPos.x < worldLeft + halfWidth)
@@ -675,20 +2806,120 @@ void Game::update(float dt)
 
     camera.setCenter(camPos);
 
-    healthBar.update();
-    // if (player.health <= 0) {
-    //     // player.respawn();
-    //     resetGame();
-    // }
+    streamChunks();
+}
+
+// Blends two ticks' positions; jumps no tick could make (respawns) snap
+static sf::Vector2f interpolate(const sf::Vector2f& previous, const sf::Vector2f& current, float alpha)
+{
+    const float teleport = 256.f;
+    if (std::abs(current.x - previous.x) > teleport || std::abs(current.y - previous.y) > teleport)
+        return current;
+    return previous + (current - previous) * alpha;
+}
+
+// Fills the world and actor batches with what the camera can see
+void Game::buildWorldBatches(const FrameSnapshot& frame, float alpha)
+{
+    PROFILE_ZONE("buildWorldBatches");
+    if (frame.chunkBegin != renderBegin || frame.chunkEnd != renderEnd) {
+        platformQuads.clear();
+        renderGrid.clear();
+        for (int chunk = frame.chunkBegin; chunk < frame.chunkEnd; chunk++) {
+            for (int index : chunks.getPlatforms(chunk)) {
+                const PlatformSpawn& spawn = level.platforms[index];
+                platformFrames[platformKinds[index]].apply(platformSprite);
+                platformSprite.setPosition(spawn.x, spawn.y);
+                platformQuads.push_back(SpriteBatch::makeQuad(platformSprite));
+                renderGrid.insert(chunks.getPlatformBounds(index));
+            }
+        }
+        renderBegin = frame.chunkBegin;
+        renderEnd = frame.chunkEnd;
+    }
+
+    sf::Vector2f center = interpolate(frame.previousCameraCenter, frame.cameraCenter, alpha);
+    sf::Vector2f size = viewSize;
+    sf::FloatRect view(center.x - size.x / 2.f, center.y - size.y / 2.f, size.x, size.y);
+
+    renderStats.submitted = 0;
+    renderStats.culled = 0;
+    worldBatch.clear();
+    actorBatch.clear();
+
+    // The background repeats along the world; only the tiles in view are drawn
+    float tileWidth = background.sprite.getLocalBounds().width;
+    if (tileWidth > 0.f) {
+        int first = std::max(static_cast<int>(std::floor((view.left - level.worldLeft) / tileWidth)), 0);
+        int last = static_cast<int>(std::floor((view.left + view.width - level.worldLeft) / tileWidth));
+        for (int tile = first; tile <= last; tile++) {
+            background.sprite.setPosition(level.worldLeft + tile * tileWidth, 0.f);
+            worldBatch.add(background.sprite);
+            renderStats.submitted++;
+        }
+    }
 
+    // Platforms were put into the grid in the same order as platformQuads
+    renderGrid.query(view, visiblePlatforms);
+    for (int index : visiblePlatforms) {
+        worldBatch.add(platformQuads[index]);
+    }
+    renderStats.submitted += visiblePlatforms.size();
+    renderStats.culled += platformQuads.size() - visiblePlatforms.size();
+
+    PlayerView playerView = frame.player;
+    playerView.position = interpolate(frame.previousPlayerPosition, frame.player.position, alpha);
+    player.draw(actorBatch, playerView);
+    renderStats.submitted++;
+
+    for (const EnemyView& enemy : frame.enemies) {
+        sf::Vector2f position = interpolate(sf::Vector2f(enemy.previousX, enemy.previousY),
+                                            sf::Vector2f(enemy.x, enemy.y), alpha);
+        if (!view.intersects(sf::FloatRect(position.x, position.y, enemy.width, enemy.height))) {
+            renderStats.culled++;
+            continue;
+        }
+
+        enemySprite.setTexture(*enemy.texture);
+        enemySprite.setTextureRect(enemy.rect);
+        enemySprite.setPosition(position);
+        enemySprite.setScale(enemy.facingRight ? enemy.scale : -enemy.scale, enemy.scale);
+        enemySprite.setOrigin(enemy.facingRight ? 0.f : enemy.rect.width, 0.f);
+        enemySprite.setColor(enemy.color);
+        actorBatch.add(enemySprite);
+        renderStats.submitted++;
+    }
+}
+
+void Game::updateHud(const FrameSnapshot& frame)
+{
+    // A simulation that is behind keeps the HUD from the last good frame
+    if (frame.degraded) return;
+
+    PROFILE_ZONE("update HUD");
+    hudHealth = frame.health;
+    hudSoul = frame.soul;
+    healthBar.update();
     soulBar.update();
 }
 
-void Game::render()
+void Game::buildFrame()
+{
+    publishSnapshot(0.f);
+    snapshots.acquire();
+
+    const FrameSnapshot& frame = snapshots.readSlot();
+    if (frame.state != 1) return;
+    buildWorldBatches(frame, 1.f);
+    updateHud(frame);
+    frameGraph.update();
+}
+
+void Game::render(const FrameSnapshot& frame)
 {
     window.clear();
 
-    if (state == 0) {
+    if (frame.state == 0) {
         window.setView(window.getDefaultView());
 
         sf::Vector2u windowSize = window.getSize(); 
@@ -704,108 +2935,152 @@ void Game::render()
         titleSprite.setPosition(100 , 50);
         window.draw(titleSprite);
 
-
-        sf::Font font;
-        font.loadFromFile("arial.ttf");
-
-        sf::Text option1("Start Game", font, 32);
-        sf::Text option2("Quit Game", font, 32);
-
-        option1.setFillColor(sf::Color(200,200,200));
-        option2.setFillColor(sf::Color(200,200,200));
-
-        option1.setPosition(700, 400);
-        option2.setPosition(705, 470);
-
-        window.draw(option1);
-        window.draw(option2);
-
-        if (option == 0) {
-            sf::FloatRect bounds = option1.getGlobalBounds();
-            sf::RectangleShape box;
-            box.setSize(sf::Vector2f(bounds.width + 20, bounds.height + 10));
-            box.setPosition(bounds.left - 10, bounds.top - 5);
-            box.setFillColor(sf::Color::Transparent);
-            box.setOutlineColor(sf::Color::White);
-            box.setOutlineThickness(2);
-            window.draw(box);
-        } else if (option == 1) {
-            sf::FloatRect bounds = option2.getGlobalBounds();
-            sf::RectangleShape box;
-            box.setSize(sf::Vector2f(bounds.width + 20, bounds.height + 10));
-            box.setPosition(bounds.left - 10, bounds.top - 5);
-            box.setFillColor(sf::Color::Transparent);
-            box.setOutlineColor(sf::Color::White);
-            box.setOutlineThickness(2);
-            window.draw(box);
-        }
+        window.draw(menuOptions[0]);
+        window.draw(menuOptions[1]);
+        window.draw(menuBoxes[frame.option]);
+        if (frame.loading) window.draw(loadingText);
 
         window.display();
         return;
     }
 
-    if (state == 2) {
+    if (frame.state == 2) {
         window.setView(window.getDefaultView());
         window.clear();
 
-        sf::Font font;
-        font.loadFromFile("arial.ttf");
-
-        sf::Text endText("GAME OVER", font, 64);
-        endText.setFillColor(sf::Color::Red);
-        endText.setPosition(600, 200);
-
-        sf::Text info("Press ENTER to return to Main Menu", font, 32);
-        info.setFillColor(sf::Color::White);
-        info.setPosition(520, 400);
-
         window.draw(endText);
-        window.draw(info);
+        window.draw(endInfo);
 
         window.display();
         return;
     }
 
-    window.setView(camera);
-
-    background.draw(window);
-
-    platform1.draw(window);
-    platform2.draw(window);
-    platform3.draw(window);
-    platform4.draw(window);
-    platform5.draw(window);
-    platform6.draw(window);
-    platform7.draw(window);
-    platform8.draw(window);
-    platform9.draw(window);
-    Platform10.draw(window);
-    Platform11.draw(window);
-    Platform12.draw(window);
-    Platform13.draw(window);
-    Platform14.draw(window);
-    Platform15.draw(window);
-    Platform16.draw(window);
-    Platform17.draw(window);
-    Platform18.draw(window);
-    Platform19.draw(window);
-    Platform20.draw(window);
-
-
-    player.draw(window);
-    if (!enemy1.isDead || enemy1.despawnTimer > 0) enemy1.draw(window);
-    if (!enemy2.isDead || enemy2.despawnTimer > 0) enemy2.draw(window);
-    if (!enemy3.isDead || enemy3.despawnTimer > 0) enemy3.draw(window);
-    if (!enemy4.isDead || enemy4.despawnTimer > 0) enemy4.draw(window);
-    if (!enemy5.isDead || enemy5.despawnTimer > 0) enemy5.draw(window);
-    if (!enemy6.isDead || enemy6.despawnTimer > 0) enemy6.draw(window);
-    // std::cout << "x: " << enemy6.sprite.getPosition().x << " ";
-    // std::cout << "y: " << enemy6.sprite.getPosition().y << std::endl;
+    // How far the renderer is between the snapshot's last two ticks
+    std::chrono::duration<float> waited = std::chrono::steady_clock::now() - frame.publishedAt;
+    float alpha = std::min((frame.remainder + waited.count()) / tickLength, 1.f);
+
+    window.setView(sf::View(interpolate(frame.previousCameraCenter, frame.cameraCenter, alpha), viewSize));
+
+    buildWorldBatches(frame, alpha);
+    {
+        PROFILE_ZONE("draw world");
+        worldBatch.draw(window);
+    }
+    {
+        PROFILE_ZONE("draw actors");
+        actorBatch.draw(window);
+    }
+    renderStats.drawCalls = worldBatch.drawCalls() + actorBatch.drawCalls();
 
     window.setView(window.getDefaultView());
 
-    healthBar.draw(window);
-    soulBar.draw(window);
+    updateHud(frame);
+    {
+        PROFILE_ZONE("draw HUD");
+        if (healthBar.isDirty() || soulBar.isDirty()) {
+            hudTexture.clear(sf::Color::Transparent);
+            healthBar.draw(hudTexture);
+            soulBar.draw(hudTexture);
+            hudTexture.display();
+            healthBar.markClean();
+            soulBar.markClean();
+        }
+        window.draw(hudSprite);
+
+        if (showFrameGraph) {
+            frameGraph.update();
+            frameGraph.draw(window);
+        }
+    }
 
+    PROFILE_ZONE("display");
     window.display(); 
-}
\ No newline at end of file
+}
+
+// The BatchRunner class, which plays many headless games across the cores
+BatchRunner::BatchRunner(unsigned threads) : pool(threads), seconds(0), ticks(0) {}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob>& jobs) {
+    LogLevel level = Logger::instance().getLevel();
+    Logger::instance().setLevel(LogNone);
+
+    // Held for the whole setup, so the sheets are decoded once per batch
+    // rather than once per game
+    bool wasHeadless = AssetManager::isHeadless();
+    AssetManager::setHeadless(true);
+    std::vector<std::shared_ptr<sf::Image>> images = AssetManager::preload(AssetManager::startupFiles());
+
+    std::vector<std::unique_ptr<Game>> games;
+    std::vector<std::unique_ptr<InputSource>> inputs;
+    games.reserve(jobs.size());
+    inputs.reserve(jobs.size());
+    for (const BatchJob& job : jobs) {
+        games.emplace_back(new Game(true, job.level));
+        if (job.script.empty()) inputs.emplace_back(new RandomInput(job.seed));
+        else inputs.emplace_back(new ScriptedInput(job.script));
+        games.back()->setDeterministic(true);
+        games.back()->setEnemyTuning(job.tuning);
+        games.back()->setInput(inputs.back().get());
+    }
+
+    std::vector<BatchResult> results(jobs.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.submit([&games, &jobs, &results, i]() {
+            Game& game = *games[i];
+            int tick = 0;
+            while (tick < jobs[i].maxTicks && game.getState() != 2) {
+                game.tick(Game::tickLength);
+                tick++;
+            }
+            BatchResult& result = results[i];
+            result.ticks = tick;
+            result.died = game.getState() == 2 && game.getPlayerHealth() <= 0;
+            result.won = game.getState() == 2 && !result.died;
+            result.defeated = game.getDefeatedCount();
+            result.enemies = game.getEnemyTotal();
+            result.health = game.getPlayerHealth();
+        });
+    }
+    pool.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds = elapsed.count();
+
+    ticks = 0;
+    for (const BatchResult& result : results) ticks += result.ticks;
+    games.clear();
+    images.clear();
+    AssetManager::setHeadless(wasHeadless);
+    Logger::instance().setLevel(level);
+    return results;
+}
+
+BatchSummary BatchRunner::summarize(const std::vector<BatchResult>& results) {
+    BatchSummary summary = BatchSummary{ static_cast<int>(results.size()), 0, 0, 0, 0.0, 0.0, 0.0 };
+    for (const BatchResult& result : results) {
+        if (result.won) summary.won++;
+        else if (result.died) summary.died++;
+        else summary.timedOut++;
+        summary.averageTicks += result.ticks;
+        summary.averageDefeated += result.defeated;
+        summary.averageHealth += result.health;
+    }
+    if (summary.runs > 0) {
+        summary.averageTicks /= summary.runs;
+        summary.averageDefeated /= summary.runs;
+        summary.averageHealth /= summary.runs;
+    }
+    return summary;
+}
+
+unsigned BatchRunner::getThreads() const {
+    return pool.size();
+}
+
+double BatchRunner::getSeconds() const {
+    return seconds;
+}
+
+long long BatchRunner::getTicks() const {
+    return ticks;
+}
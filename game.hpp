@@ -6,34 +6,461 @@
 #include <string>
 #include <cmath> 
 #include <string>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <condition_variable>
+#include <random>
 
 using namespace std;
 
+enum LogLevel {
+    LogDebug,
+    LogInfo,
+    LogWarning,
+    LogError,
+    LogNone      // only for setLevel: nothing is logged
+};
+
+// Lock-free single-producer ring buffer for messages from the game loop. The
+// logging thread formats into a fixed slot and moves on; a background thread
+// writes the slots to the console. Only one thread may log at a time, and a
+// full buffer drops messages rather than stalling the game.
+class Logger {
+public:
+    static Logger& instance();
+    ~Logger();
+
+    void log(LogLevel level, const char* format, ...);
+    void setLevel(LogLevel minimum);
+    LogLevel getLevel() const;
+    void flush();
+
+private:
+    Logger();
+    void drain();
+
+    static const uint32_t capacity = 1024;
+    struct Entry {
+        LogLevel level;
+        char text[124];
+    };
+
+    Entry entries[capacity];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> dropped;
+    std::atomic<int> minimum;
+    std::atomic<bool> running;
+    std::thread worker;
+};
+
+// Build with -DGAME_LOGGING=0 to compile every LOG call out of the game
+#ifndef GAME_LOGGING
+#define GAME_LOGGING 1
+#endif
+
+#if GAME_LOGGING
+#define LOG(level, ...) Logger::instance().log(level, __VA_ARGS__)
+#else
+#define LOG(level, ...) ((void)0)
+#endif
+
+// Scoped timing zones for finding where a frame goes. Every thread records
+// into its own fixed ring of events, so a zone costs two clock reads and a
+// store; writeTrace() dumps the rings as Chrome trace_event JSON for
+// chrome://tracing or Perfetto. Zones do nothing until profiling is enabled.
+class Profiler {
+public:
+    static Profiler& instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    // Labels the calling thread in the trace
+    void nameThread(const char* name);
+
+    int64_t now() const;
+    void record(const char* name, int64_t start, int64_t end);
+
+    // Only call while no other thread is recording
+    bool writeTrace(const std::string& filename) const;
+
+private:
+    Profiler();
+
+    static const uint32_t capacity = 1 << 16;
+    struct Event {
+        const char* name;
+        int64_t start;
+        int64_t end;
+    };
+    struct ThreadBuffer {
+        int id;
+        const char* name;
+        uint32_t count;
+        Event events[capacity];
+    };
+
+    ThreadBuffer& buffer();
+
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<bool> enabled;
+    mutable std::mutex lock;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name);
+    ~ProfileZone();
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+// Build with -DGAME_PROFILING=0 to compile every zone out of the game
+#ifndef GAME_PROFILING
+#define GAME_PROFILING 1
+#endif
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profileZone, line)
+#if GAME_PROFILING
+#define PROFILE_ZONE(name) ProfileZone PROFILE_NAME(__LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
+
+// A fixed set of worker threads that run submitted jobs in submission order
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    void submit(std::function<void()> job);
+    // Returns once every job submitted so far has finished
+    void wait();
+    unsigned size() const;
+
+private:
+    void work();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    int pending;
+    bool stopping;
+};
+
+// Keys the simulation reads, packed into one bitmask per tick
+enum InputKey {
+    KeyLeft   = 1 << 0,   // A
+    KeyRight  = 1 << 1,   // D
+    KeyJump   = 1 << 2,   // W
+    KeyHeal   = 1 << 3,   // Q
+    KeyAttack = 1 << 4,   // M
+    KeyUp     = 1 << 5,
+    KeyDown   = 1 << 6,
+    KeyEnter  = 1 << 7
+};
+
+// Where the simulation gets its input from, one bitmask of held keys per tick
+class InputSource {
+public:
+    virtual ~InputSource() = default;
+    virtual unsigned poll() = 0;
+    // The keys pressed during the tick just polled, for sources that know
+    // them exactly. Otherwise they come from window events or, headless,
+    // from the keys that went down since the last tick.
+    virtual bool pollPresses(unsigned&) { return false; }
+};
+
+// The live keyboard. The window's thread samples it with refresh() and the
+// simulation thread reads the latest sample with poll().
+class KeyboardInput : public InputSource {
+public:
+    KeyboardInput();
+    void refresh();
+    unsigned poll() override;
+
+private:
+    std::atomic<unsigned> keys;
+};
+
+// Plays back a fixed list of per-tick key masks, optionally looping forever
+class ScriptedInput : public InputSource {
+public:
+    ScriptedInput(const std::vector<unsigned>& script, bool loop = true);
+    unsigned poll() override;
+    bool finished() const;
+
+private:
+    std::vector<unsigned> script;
+    size_t position;
+    bool loop;
+};
+
+// Mashes keys the same way for the same seed: after pressing Enter to
+// start, it holds a random mix of movement, jump, attack and heal for a
+// random stretch of ticks, then picks again
+class RandomInput : public InputSource {
+public:
+    explicit RandomInput(uint32_t seed);
+    unsigned poll() override;
+
+private:
+    std::mt19937 random;
+    unsigned keys;
+    int remaining;
+    int ticks;
+};
+
+// Recorded input file: InputHeader, then runCount InputRun records. A run
+// is one tick's held keys in the low byte and the keys pressed during it in
+// the high byte, repeated for ticks ticks.
+struct InputHeader {
+    char magic[4];
+    uint32_t tickCount;
+    uint32_t runCount;
+    float viewWidth, viewHeight;
+    char level[64];
+};
+
+struct InputRun {
+    uint16_t keys;
+    uint16_t ticks;
+};
+
+// Collects the input the simulation used, tick by tick, run-length encoded
+class InputRecorder {
+public:
+    explicit InputRecorder(const std::string& level);
+
+    void record(unsigned keys, unsigned pressed);
+    bool save(const std::string& filename, sf::Vector2f viewSize) const;
+    unsigned getTickCount() const;
+
+private:
+    std::string level;
+    std::vector<InputRun> runs;
+    unsigned ticks;
+};
+
+// Plays a recording back, one tick per poll, presses included
+class ReplayInput : public InputSource {
+public:
+    ReplayInput();
+
+    bool load(const std::string& filename);
+    unsigned poll() override;
+    bool pollPresses(unsigned& pressed) override;
+    bool finished() const;
+
+    const std::string& getLevel() const;
+    sf::Vector2f getViewSize() const;
+    unsigned getTickCount() const;
+
+private:
+    InputHeader header;
+    std::string level;
+    std::vector<InputRun> runs;
+    size_t run;
+    unsigned tickInRun;
+    unsigned current;
+};
+
+// A named sprite frame: the texture it lives on and the part of it to draw
+struct SpriteFrame {
+    std::shared_ptr<sf::Texture> texture;
+    sf::IntRect rect;
+
+    void apply(sf::Sprite& sprite) const;
+};
+
+// Header and index entries of the baked atlas file. The file is laid out as
+// AtlasHeader, frameCount AtlasEntry records, then width * height RGBA pixels.
+struct AtlasHeader {
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameCount;
+};
+
+struct AtlasEntry {
+    char name[32];
+    int32_t x, y, width, height;
+};
+
+// Shared texture cache. Every file (or file + sub-rect) is decoded and uploaded
+// once; objects keep a shared_ptr to the texture they borrow, and the cache
+// forgets it again when the last owner goes away.
+class AssetManager {
+public:
+    static std::shared_ptr<sf::Texture> getTexture(const std::string& filename);
+    static std::shared_ptr<sf::Texture> getTexture(const std::string& filename, const sf::IntRect& area);
+    static std::shared_ptr<sf::Image> getImage(const std::string& filename);
+    static std::shared_ptr<sf::Font> getFont(const std::string& filename);
+
+    // Frames come from the baked atlas when it exists, otherwise they are cut
+    // from their source sheets at runtime
+    static SpriteFrame getFrame(const std::string& name);
+    static bool packAtlas(const std::string& filename);
+
+    // Decodes images on a pool of threads into the image cache. The cache
+    // only holds them while the returned pointers live, so keep those until
+    // the textures made from them are uploaded.
+    static std::vector<std::shared_ptr<sf::Image>> preload(const std::vector<std::string>& files,
+                                                          unsigned threads = std::thread::hardware_concurrency());
+    // Every image the game decodes before its first frame, and the part of
+    // it the main menu needs
+    static std::vector<std::string> startupFiles();
+    static std::vector<std::string> menuFiles();
+
+    // Starts decoding files in the background. Textures made from them in
+    // the meantime are handed out empty and filled in by updateStreaming(),
+    // which must run on the thread that owns the window.
+    static void stream(const std::vector<std::string>& files);
+    // Uploads whatever has finished decoding; true once nothing is left
+    static bool updateStreaming();
+
+    // Known before the image is decoded when the file is a PNG
+    static sf::Vector2u getImageSize(const std::string& filename);
+
+    static const std::string atlasFile;
+
+    // Headless mode never touches the GPU: textures stay empty and only the
+    // frame rects are resolved, which is all the simulation needs
+    static bool setHeadless(bool enabled);
+    static bool isHeadless();
+
+private:
+    static void loadAtlasIndex();
+    static std::shared_ptr<sf::Texture> getAtlasTexture();
+
+    struct StreamedImage {
+        std::string filename;
+        std::shared_ptr<sf::Image> image;
+        bool loaded;
+        std::atomic<bool> ready;
+    };
+    struct PendingUpload {
+        std::shared_ptr<sf::Texture> texture;
+        std::string filename;
+        sf::IntRect area;
+    };
+    static StreamedImage* findStream(const std::string& filename);
+    static std::vector<std::unique_ptr<StreamedImage>> streams;
+    static std::vector<PendingUpload> pendingUploads;
+    static std::unique_ptr<ThreadPool> streamPool;
+
+    static std::map<std::string, std::weak_ptr<sf::Texture>> textures;
+    static std::map<std::string, std::weak_ptr<sf::Image>> images;
+    static std::map<std::string, std::weak_ptr<sf::Font>> fonts;
+    static std::map<std::string, sf::IntRect> atlasFrames;
+    static bool atlasIndexLoaded;
+    static bool headless;
+};
+
+// Collects sprites into one vertex array per texture, so every texture is
+// bound and drawn once per batch no matter how many sprites use it
+class SpriteBatch {
+public:
+    // A sprite already turned into two triangles, for geometry that is
+    // worth transforming once and keeping
+    struct Quad {
+        const sf::Texture* texture;
+        sf::Vertex vertices[6];
+    };
+    static Quad makeQuad(const sf::Sprite& sprite);
+
+    void clear();
+    void add(const sf::Sprite& sprite);
+    void add(const Quad& quad);
+    void draw(sf::RenderTarget& target) const;
+    int drawCalls() const;
+
+private:
+    struct Group {
+        const sf::Texture* texture;
+        sf::VertexArray vertices;
+    };
+    std::vector<Group> groups;
+};
+
+// What the last rendered frame sent to the GPU and what culling skipped
+struct RenderStats {
+    int submitted;
+    int culled;
+    int drawCalls;
+};
+
+// Uniform grid over static level geometry. Each rect is stored in every cell
+// it overlaps, so a query only visits the cells its own area covers.
+class SpatialGrid {
+public:
+    explicit SpatialGrid(float cellSize = 256.f);
+
+    void clear();
+    int insert(const sf::FloatRect& rect);
+
+    // Indices of the rects that intersect area, in insertion order
+    void query(const sf::FloatRect& area, std::vector<int>& result) const;
+
+    const sf::FloatRect& getRect(int index) const;
+    int size() const;
+
+private:
+    long long cellKey(int cellX, int cellY) const;
+
+    float cellSize;
+    std::vector<sf::FloatRect> rects;
+    std::unordered_map<long long, std::vector<int>> cells;
+};
+
 class UIElement {
 protected:
     sf::Text text;
-    sf::Font font;
+    std::shared_ptr<sf::Font> font;
+    // Set by update() when the next draw would look different
+    bool dirty;
 
 public:
     UIElement();
     virtual ~UIElement() = default;
-    virtual void draw(sf::RenderWindow& window) = 0;
+    virtual void draw(sf::RenderTarget& target) = 0;
     virtual void update() = 0;
+
+    bool isDirty() const;
+    void markClean();
 };
 
 
 class HealthBar : public UIElement {
 private:
     int* playerHealth;
+    int shownHealth;
     int maxHealth;
-    sf::Texture fullHealthTexture;
-    sf::Texture lowHealthTexture;
+    SpriteFrame fullHealthFrame;
+    SpriteFrame lowHealthFrame;
     sf::Sprite healthSprites[10];
+    SpriteBatch batch;
 
 
 public:
     HealthBar(int* health, int maxHP);
-    void draw(sf::RenderWindow& window) override;
+    void draw(sf::RenderTarget& target) override;
     void update() override;
     void takeDamage(int damage);
 };
@@ -42,12 +469,39 @@ public:
 class SoulBar : public UIElement {
 private:
     int* playerSoul;
-    sf::Texture texture;
+    int shownSoul;
+    SpriteFrame frame;
     sf::Sprite sprites[4];
+    // Four orbs of five soul each; the labels up to there are made up front
+    static const int maxSoul = 20;
+    sf::String labels[maxSoul + 1];
+    SpriteBatch batch;
 
 public:
     SoulBar(int* soul);
-    void draw(sf::RenderWindow& window) override;
+    void draw(sf::RenderTarget& target) override;
+    void update() override;
+};
+
+// The last few seconds of frame times as a line graph, with a line at the
+// 60 Hz budget
+class FrameTimeGraph : public UIElement {
+private:
+    static const int history = 240;
+    float times[history];
+    int next;
+    sf::VertexArray graph;
+    sf::RectangleShape budgetLine;
+    sf::Vector2f position;
+    // The label keeps one width, so it is rewritten in place rather than
+    // converted from text each time the worst frame changes
+    char label[32];
+    sf::String labelText;
+
+public:
+    FrameTimeGraph();
+    void record(float milliseconds);
+    void draw(sf::RenderTarget& target) override;
     void update() override;
 };
 
@@ -57,30 +511,96 @@ public:
     void draw(sf::RenderWindow& window);
 
 private:
-    sf::Texture texture;
+    std::shared_ptr<sf::Texture> texture;
     sf::Sprite sprite;
     friend class Game;
 };
 
 
+// What the renderer needs to draw the player and one enemy
+struct PlayerView {
+    sf::Vector2f position;
+    sf::Vector2f scale;
+    sf::Vector2f origin;
+    sf::Color color;
+    bool facingRight;
+    bool attacking;
+};
+
+struct EnemyView {
+    float x, y;
+    float previousX, previousY;
+    float scale;
+    float width, height;
+    bool facingRight;
+    sf::Color color;
+    const sf::Texture* texture;
+    sf::IntRect rect;
+};
+
+// A fixed-point number with 16 fractional bits. Integer math comes out the
+// same whatever the compiler, its flags or the CPU, unlike float math.
+struct Fixed {
+    int64_t raw;
+
+    static Fixed fromFloat(float value) { return Fixed{ std::llround(value * 65536.f) }; }
+    float toFloat() const { return raw / 65536.f; }
+
+    Fixed operator+(Fixed other) const { return Fixed{ raw + other.raw }; }
+    Fixed operator-(Fixed other) const { return Fixed{ raw - other.raw }; }
+    Fixed operator*(Fixed other) const { return Fixed{ (raw * other.raw) >> 16 }; }
+    Fixed operator-() const { return Fixed{ -raw }; }
+    bool operator<(Fixed other) const { return raw < other.raw; }
+    bool operator>(Fixed other) const { return raw > other.raw; }
+    bool operator<=(Fixed other) const { return raw <= other.raw; }
+    bool operator>=(Fixed other) const { return raw >= other.raw; }
+    bool operator==(Fixed other) const { return raw == other.raw; }
+    bool operator!=(Fixed other) const { return raw != other.raw; }
+};
+
+// Position, size and velocity of a character in fixed point
+struct FixedBody {
+    Fixed x, y;
+    Fixed width, height;
+    Fixed vx, vy;
+};
+
 class Character {
 public:
     Character();
     virtual ~Character() {}
 
-    virtual void update(float dt, sf::FloatRect platformBounds[]) = 0;
-    virtual void draw(sf::RenderWindow& window) = 0;
+    virtual void update(float dt, const SpatialGrid& level) = 0;
+    virtual void draw(SpriteBatch& batch) = 0;
     
     sf::FloatRect getBounds() const;
     sf::Vector2f getPosition() const;
+    void setPosition(float x, float y);
     bool isFacingRight() const;
+
+    // Moves the character with fixed-point math instead of floats, so a run
+    // can be reproduced exactly from its inputs on any build
+    void setDeterministic(bool enabled);
+    // FNV-1a hash of the fixed-point movement state
+    uint64_t stateHash() const;
     
     virtual void setColor(const sf::Color& color) = 0;
 
     int health;
     int damage;
 protected:
-    sf::Texture texture;
+    void setVelocity(float x, float y);
+    // Applies gravity and velocity over dt, then resolves platform hits:
+    // a blocked horizontal move is undone and only the first platform hit
+    // (in chunk order, then level order within a chunk) is resolved
+    // vertically
+    void move(float dt, const SpatialGrid& level);
+    void moveFloat(float dt, const SpatialGrid& level);
+    void moveFixed(float dt, const SpatialGrid& level);
+    // Platforms the body would overlap at (x, y), decided in fixed point
+    void findHits(const SpatialGrid& level, Fixed x, Fixed y);
+
+    SpriteFrame frame;
     sf::Sprite sprite;
     
     float vx, vy;
@@ -88,16 +608,41 @@ protected:
     
     bool facingRight;
     bool onGround;
-    
+
+    bool deterministic;
+    FixedBody body;
+    std::vector<int> hits;
+};
+
+// Everything about the player a tick reads or writes, as plain data
+struct PlayerState {
+    float x, y;
+    Fixed bodyX, bodyY, bodyVx, bodyVy;
+    float vx, vy;
+    int32_t health;
+    int32_t soul;
+    uint32_t input;
+    uint8_t facingRight, onGround, isAttacking, attacked;
+    float attackDuration;
+    float attackCooldown;
+    // The sprite's facing is set by the last move, not by facingRight
+    float scaleX, scaleY;
+    float originX, originY;
 };
 
 class Player : public Character {
 public:
     Player();
 
-    void update(float dt, sf::FloatRect platformBounds[]) override;
-    void draw(sf::RenderWindow& window) override;
+    PlayerState saveState() const;
+    void restoreState(const PlayerState& saved);
+
+    void update(float dt, const SpatialGrid& level) override;
+    void draw(SpriteBatch& batch) override;
+    void draw(SpriteBatch& batch, const PlayerView& view);
+    PlayerView getView() const;
     sf::FloatRect getAttackHitbox() const;
+    static sf::FloatRect attackHitbox(const sf::FloatRect& bounds, bool facingRight);
     void meleeAttack();
 
     void jump();
@@ -105,6 +650,8 @@ public:
     void heal();
     void setColor(const sf::Color& color);
     void respawn();
+
+    unsigned input;
     
 private:
     int damage;
@@ -118,114 +665,544 @@ private:
     float attackDuration;
     float attackCooldown;
     
-    sf::Texture attackTexture;
+    SpriteFrame attackFrame;
+
+    // Only touched while drawing, which may happen on another thread
+    sf::Sprite renderSprite;
     sf::Sprite attackSprite;
     friend class Game;
 };
 
-class Enemy : public Character {
+// Spawn parameters for one enemy and one platform. These are plain data so
+// a compiled level file can be used in place.
+struct EnemySpawn {
+    float x, y;
+    float patrolLeft, patrolRight;
+    char frame[16];
+    float scale;
+    int32_t health;
+    int32_t damage;
+    float attackRange;
+};
+
+struct PlatformSpawn {
+    float x, y;
+    char frame[16];
+};
+
+// Compiled level file: LevelHeader, then platformCount PlatformSpawn and
+// enemyCount EnemySpawn records
+struct LevelHeader {
+    char magic[4];
+    float worldLeft;
+    float worldRight;
+    uint32_t platformCount;
+    uint32_t enemyCount;
+};
+
+// A level's world bounds, platforms and enemy spawns. A compiled .lvl file
+// is memory-mapped and its records are used where they lie; a .txt level is
+// compiled into memory first.
+class Level {
 public:
-    Enemy(float startX, float startY, float leftBound, float rightBound, string filename, float scale, int healthAmount, int damageAmount,
-    float atr);
+    Level();
+    ~Level();
 
-    void update(float dt, sf::FloatRect platformBounds[]) override;
-    void draw(sf::RenderWindow& window) override;
-    float distanceToPlayer(Player& player);
-    void setPlayer(Player* player);
-    void setColor(const sf::Color& color);
-    void reset(float startX, float startY , int hlt);
+    // Loads name + ".lvl" if it exists, otherwise parses name + ".txt"
+    bool load(const std::string& name);
+    static bool compile(const std::string& textFile, const std::string& binaryFile);
+
+    float worldLeft;
+    float worldRight;
+    const PlatformSpawn* platforms;
+    int platformCount;
+    const EnemySpawn* enemies;
+    int enemyCount;
+
+private:
+    Level(const Level&) = delete;
+    Level& operator=(const Level&) = delete;
 
+    static bool parse(const std::string& textFile, std::vector<char>& data);
+    bool use(const char* data, size_t size);
+    void unload();
+
+    void* mapping;
+    size_t mappingSize;
+    std::vector<char> buffer;
+};
+
+// Splits a level into fixed-width columns so that only the ones around the
+// camera are simulated and drawn. Platforms belong to the chunk their left
+// edge is in and enemies to the chunk of their patrol range they start in.
+class ChunkMap {
+public:
+    explicit ChunkMap(float chunkWidth = 2048.f);
 
+    // Platform bounds come from the size of each platform's frame, given
+    // once per distinct frame as the game resolved them
+    void build(const Level& level, const std::vector<int>& platformKinds, const std::vector<SpriteFrame>& platformFrames);
+
+    int count() const;
+    int chunkAt(float x) const;
+    const std::vector<int>& getPlatforms(int chunk) const;
+    const std::vector<int>& getEnemies(int chunk) const;
+    int getEnemyChunk(int enemy) const;
+    const sf::FloatRect& getPlatformBounds(int platform) const;
 
 private:
-    float attackRange;
+    float chunkWidth;
+    float worldLeft;
+    std::vector<std::vector<int>> platforms;
+    std::vector<std::vector<int>> enemies;
+    std::vector<sf::FloatRect> platformBounds;
+    std::vector<int> enemyChunks;
+};
+
+// All enemies of a level, stored as parallel arrays so the per-tick update
+// walks contiguous memory. Sprites are only put together when drawing.
+class EnemyPool {
+public:
+    EnemyPool();
+
+    int spawn(const EnemySpawn& spawn, int id = -1);
+    // Keeps the enemies whose flag is set, in order
+    void retain(const std::vector<unsigned char>& keep);
+    void clear();
+    // Remembers where every enemy is, for the renderer to interpolate from
+    void savePositions();
+    // Appends the whole pool to a snapshot, array by array, and reads it
+    // back
+    void save(std::vector<unsigned char>& out) const;
+    // Takes exactly the bytes from in to end, with every id below idCount
+    // and every kind one the pool knows, or returns false and keeps the
+    // pool as it was
+    bool restore(const unsigned char* in, const unsigned char* end, int idCount);
+
+    // With an awake area, enemies outside it are dormant: every
+    // dormantInterval ticks they catch up on the time they slept in one
+    // step, and with an interval of 0 they keep still. Dead enemies leave
+    // the pool once they have faded out.
+    void update(float dt, Player& player, const sf::FloatRect* awake = nullptr, int dormantInterval = 0);
+    // Appends what the renderer needs for every visible enemy
+    void capture(std::vector<EnemyView>& views) const;
+
+    int size() const;
+    bool allDead() const;
+    bool isVisible(int i) const;
+    sf::FloatRect getBounds(int i) const;
+
+    // Hot simulation state. Movement and aggro are fixed point, so enemies
+    // move the same on every build; the renderer gets floats.
+    std::vector<Fixed> x, y;
+    std::vector<float> previousX, previousY;
+    std::vector<Fixed> vx;
+    std::vector<Fixed> patrolLeft, patrolRight;
+    std::vector<Fixed> attackRange;
+    std::vector<Fixed> attackTimer;
+    std::vector<float> colorTimer;
+    std::vector<float> despawnTimer;
+    std::vector<double> steppedAt;
+    std::vector<int> health;
+    std::vector<int> damage;
+    std::vector<unsigned char> isDead;
+    std::vector<unsigned char> facingRight;
+    std::vector<unsigned char> isAttacking;
+    std::vector<unsigned char> isDormant;
+
+    // The caller's id for each enemy, e.g. its index in the level
+    std::vector<int> id;
+
+    // Only needed for bounds and drawing
+    std::vector<float> width, height;
+    std::vector<float> scale;
+    std::vector<int> kind;
+    std::vector<sf::Color> color;
+
+    // Run the movement and aggro kernel four enemies at a time in builds
+    // that target AVX2. Both paths are integer math and give identical
+    // results.
+    bool useBatch;
+
+    // Resolves a frame up front, so spawning it later touches no assets
+    int findKind(const std::string& frameName);
+
+private:
+    // Calls f on every per-enemy array except the renderer's previous
+    // positions, so clearing, filtering and snapshots cannot miss one
+    template <typename Pool, typename F>
+    static void forEachArray(Pool& pool, F f) {
+        f(pool.spawns); f(pool.id);
+        f(pool.x); f(pool.y); f(pool.vx);
+        f(pool.patrolLeft); f(pool.patrolRight); f(pool.attackRange);
+        f(pool.attackTimer); f(pool.colorTimer); f(pool.despawnTimer); f(pool.steppedAt);
+        f(pool.health); f(pool.damage);
+        f(pool.isDead); f(pool.facingRight); f(pool.isAttacking); f(pool.isDormant);
+        f(pool.width); f(pool.height); f(pool.scale); f(pool.kind); f(pool.color);
+    }
+
+    int stepBatch(float dt, sf::Vector2f playerPos);
+    void stepScalar(int begin, int end, float dt, sf::Vector2f playerPos, bool wake = false);
+
     float chaseSpeed;
-    float attackCooldown; 
-    float attackTimer;    
-    bool isAttacking = false;     
-    float colorTimer;
-    bool isDead;
-    float despawnTimer;
-    Player* targetPlayer;
-    float patrolLeft;
-    float patrolRight;
-    float scale;
     float patrolSpeed;
-    friend class Game;
+    float attackCooldown;
+    double clock;
+    unsigned tickCount;
+
+    // Scratch flags for dropping faded out enemies
+    std::vector<unsigned char> survivors;
+
+    std::vector<EnemySpawn> spawns;
+    std::vector<std::string> kindNames;
+    std::vector<SpriteFrame> kindFrames;
 };
 
 class Platform {
 public:
     Platform();
-    Platform(const std::string& filename, float x, float y);
+    Platform(const std::string& frameName, float x, float y);
 
     ~Platform() = default;
 
-    void draw(sf::RenderWindow& window);
+    void draw(SpriteBatch& batch) const;
+    SpriteBatch::Quad getQuad() const;
 
     sf::FloatRect getBounds() const;
 
 
 protected:
-    sf::Texture texture;
+    SpriteFrame frame;
     sf::Sprite sprite;
 };
 
 
 
+// Turns elapsed real time into a number of fixed ticks. A call never asks
+// for more than maxSteps ticks; older time is dropped and counted as debt
+// instead, so one stall cannot make every following frame slower.
+class FixedStepper {
+public:
+    explicit FixedStepper(float step, int maxSteps = 5);
+
+    int advance(float elapsed);
+
+    // Measured cost of one tick, averaged against the budget
+    void recordTick(float seconds);
+    void setBudget(float seconds);
+
+    // When degradable, a stepper that is over budget or had to drop time
+    // asks for non-essential work to be skipped
+    void setDegradable(bool enabled);
+    bool isDegraded() const;
+
+    float getStep() const;
+    float getRemainder() const;
+    float getDebt() const;
+    float getAverageCost() const;
+
+private:
+    float step;
+    int maxSteps;
+    float accumulated;
+    float debt;
+    float budget;
+    float averageCost;
+    bool degradable;
+    bool degraded;
+};
+
+// Multipliers for the enemy stats a level file gives, for tuning by
+// simulation
+struct EnemyTuning {
+    float health;
+    float damage;
+    float attackRange;
+};
+
+// The fixed-size part of a game snapshot. A snapshot is this, then the
+// enemy pool's arrays, then one defeated flag per enemy of the level.
+struct GameState {
+    int32_t state;
+    int32_t option;
+    uint8_t startRequested;
+    uint32_t previousKeys;
+    float cameraX, cameraY;
+    int32_t loadedBegin, loadedEnd;
+    int32_t levelEnemies;
+    int32_t defeatedCount;
+    PlayerState player;
+};
+
+// Everything the renderer needs from one simulation tick
+struct FrameSnapshot {
+    int state;
+    int option;
+    sf::Vector2f cameraCenter;
+    sf::Vector2f previousCameraCenter;
+    PlayerView player;
+    sf::Vector2f previousPlayerPosition;
+    int health;
+    int soul;
+    bool degraded;
+    bool loading;
+    int chunkBegin;
+    int chunkEnd;
+    std::vector<EnemyView> enemies;
+
+    // Simulation time left over after the last tick, and when it was taken
+    float remainder;
+    std::chrono::steady_clock::time_point publishedAt;
+};
+
+// Lock-free triple buffer between the simulation and the renderer. The
+// simulation always has a slot of its own to fill, and the renderer always
+// reads the newest complete one, so neither ever waits for the other.
+class SnapshotBuffer {
+public:
+    SnapshotBuffer();
+
+    FrameSnapshot& writeSlot();
+    void publish();
+
+    // Switches to the newest published snapshot; false if there is none yet
+    bool acquire();
+    const FrameSnapshot& readSlot() const;
+
+private:
+    static const int fresh = 4;
+
+    FrameSnapshot slots[3];
+    int writeIndex;
+    int readIndex;
+    std::atomic<int> shared;
+};
+
 class Game {
 public:
-    Game();
+    explicit Game(bool headlessMode = false, const std::string& levelName = "levels/level1");
+    // Runs the simulation on its own thread while this thread handles the
+    // window and draws the newest published snapshot
     void run();
 
+    // Runs one fixed step driven by the current input source. This is all a
+    // headless game does: no window, no events and no rendering.
+    void tick(float dt);
+
+    // Runs the ticks that elapsed real time allows and returns how many
+    int advance(float elapsed);
+    FixedStepper& getStepper();
+
+    // Publishes a snapshot and does everything render() does with it short
+    // of drawing, for measuring a frame without a window
+    void buildFrame();
+
+    static constexpr float tickLength = 1.0f / 60.0f;
+    // Enemies more than half a view off screen think once every this many ticks
+    static constexpr int dormantInterval = 8;
+    void setInput(InputSource* source);
+    // Records the input of every tick from now on. Recording switches to
+    // deterministic movement and never degrades, so a replay on any build
+    // goes the same way.
+    void setRecorder(InputRecorder* recorder);
+    // Headless games use the view of a 1920x1080 desktop unless told
+    // otherwise, e.g. to match a recording
+    void setViewSize(sf::Vector2f size);
+    sf::Vector2f getViewSize() const;
+    // Switches the player to fixed-point movement, see Character
+    void setDeterministic(bool enabled);
+    // Hash of the player's movement state and everything else a tick
+    // decides with integers: health, soul, game state and enemy health
+    uint64_t stateHash() const;
+    // How many chunks either side of the camera's are kept loaded
+    void setChunkRadius(int chunks);
+
+    // Copies all gameplay state into a flat buffer, which keeps its
+    // capacity between saves, or back out of one. Input sources, the
+    // stepper and everything the renderer owns are left out. A snapshot of
+    // another level is refused.
+    void saveState(std::vector<unsigned char>& out) const;
+    bool restoreState(const std::vector<unsigned char>& in);
+
+    // Scales every enemy of the level. Call it before the first tick: it
+    // respawns the loaded enemies and makes the result the reset state.
+    void setEnemyTuning(const EnemyTuning& tuning);
+
+    const RenderStats& getRenderStats() const;
+    sf::Vector2f getPlayerPosition() const;
+    // How a headless run stands: state is 0 in the menu, 1 playing, 2 over
+    int getState() const;
+    int getPlayerHealth() const;
+    int getDefeatedCount() const;
+    int getEnemyTotal() const;
+
 private:
+    bool headless;
+    // Decoded in parallel before anything below is constructed
+    std::vector<std::shared_ptr<sf::Image>> startupImages;
     sf::RenderWindow window;
-    sf::Clock clock;
     sf::View camera;
+    sf::Vector2f viewSize;
+
+    KeyboardInput keyboard;
+    InputSource* input;
+    InputRecorder* recorder;
+    unsigned previousKeys;
+
+    // Key presses from window events, taken one per tick in the order they
+    // came, so a recorded tick never holds two presses whose order matters
+    std::mutex pressLock;
+    std::vector<unsigned> pendingPresses;
+
+    FixedStepper stepper;
+    bool degraded;
+
+    // Gameplay assets stream in behind the menu; starting the game before
+    // they are all uploaded waits on the menu
+    std::atomic<bool> assetsReady;
+    bool startRequested;
+
+    SnapshotBuffer snapshots;
+    sf::Vector2f previousCamera;
+    sf::Vector2f previousPlayer;
+    std::atomic<bool> running;
+    std::atomic<bool> quitRequested;
+
+    // F3 shows the frame-time graph, F4 turns profiling on and off; a trace
+    // is written to traceFile on exit if profiling was ever on
+    FrameTimeGraph frameGraph;
+    bool showFrameGraph;
+    bool profiled;
+    static const char* traceFile;
 
     int state;
     int option;
-    sf::Texture titleTexture;
+    SpriteFrame titleFrame;
     sf::Sprite titleSprite;
 
+    // Menu and game over text is built once; the font keeps its glyphs cached
+    std::shared_ptr<sf::Font> font;
+    sf::Text menuOptions[2];
+    sf::RectangleShape menuBoxes[2];
+    sf::Text loadingText;
+    sf::Text endText;
+    sf::Text endInfo;
+
     Background background;
     Background mainmenu;
     Player player;
-    Platform platform1;
-    Platform platform2;
-    Platform platform3;
-    Platform platform4;
-    Platform platform5;
-    Platform platform6;
-    Platform platform7;
-    Platform platform8;
-    Platform platform9;
-    Platform Platform10;
-    Platform Platform11;
-    Platform Platform12;
-    Platform Platform13;
-    Platform Platform14;
-    Platform Platform15;
-    Platform Platform16;
-    Platform Platform17;
-    Platform Platform18;
-    Platform Platform19;
-    Platform Platform20;
-    Enemy enemy1;
-    Enemy enemy2;
-    Enemy enemy3;
-    Enemy enemy4;
-    Enemy enemy5;
-    Enemy enemy6;
+    Level level;
+    SpatialGrid platformGrid;
+
+    // Chunks [loadedBegin, loadedEnd) are simulated; enemies killed in a
+    // chunk stay dead when it is unloaded and loaded again
+    ChunkMap chunks;
+    int chunkRadius;
+    int loadedBegin;
+    int loadedEnd;
+    std::vector<unsigned char> defeated;
+    int defeatedCount;
+    std::vector<unsigned char> keepEnemies;
+    EnemyTuning tuning;
+    // How the game stood once constructed; resetGame goes back to it
+    std::vector<unsigned char> startState;
 
+    // The renderer's own copy of the loaded platforms, transformed when the
+    // loaded chunks change; every frame copies in just the visible quads
+    std::vector<SpriteBatch::Quad> platformQuads;
+    std::vector<int> visiblePlatforms;
+    // One frame per distinct platform frame name, resolved with the level;
+    // holding them keeps the textures alive for the quads
+    std::vector<std::string> platformKindNames;
+    std::vector<SpriteFrame> platformFrames;
+    std::vector<int> platformKinds;
+    sf::Sprite platformSprite;
+    SpatialGrid renderGrid;
+    int renderBegin;
+    int renderEnd;
+    SpriteBatch worldBatch;
+    SpriteBatch actorBatch;
+    sf::Sprite enemySprite;
+    RenderStats renderStats;
+    EnemyPool enemies;
+
+    // The HUD is drawn from snapshot values, not the live player
+    int hudHealth;
+    int hudSoul;
     HealthBar healthBar;
     SoulBar soulBar;
+    // The bars composed once per change, drawn as a single quad
+    sf::RenderTexture hudTexture;
+    sf::Sprite hudSprite;
 
     void processEvents();
+    void handlePress(unsigned key);
     void update(float dt);
-    void render();
+    void simulate();
+    void savePreviousState();
+    void publishSnapshot(float remainder);
+    void render(const FrameSnapshot& frame);
+    void updateHud(const FrameSnapshot& frame);
+    void buildWorldBatches(const FrameSnapshot& frame, float alpha);
 
     void resetGame();
+    void loadLevel(const std::string& name);
+    void streamChunks();
+    void buildPlatformGrid();
+    int findPlatformKind(const std::string& frameName);
+    void buildMenuText();
+};
+
+// One headless game for the batch runner: its level, how its enemies are
+// tuned, the input that drives it and how long it may run. An empty script
+// means random input from the seed.
+struct BatchJob {
+    std::string level;
+    EnemyTuning tuning;
+    std::vector<unsigned> script;
+    uint32_t seed;
+    int maxTicks;
+};
+
+struct BatchResult {
+    int ticks;
+    bool won;
+    bool died;
+    int defeated;
+    int enemies;
+    int health;
+};
+
+struct BatchSummary {
+    int runs;
+    int won;
+    int died;
+    int timedOut;
+    double averageTicks;
+    double averageDefeated;
+    double averageHealth;
+};
+
+// Plays many headless games at once, one pool job per game. Games are
+// built and destroyed on the calling thread, because the asset cache is
+// not thread-safe, and only their ticks run on the workers. Logging is off
+// for the run, since the logger takes a single producer.
+class BatchRunner {
+public:
+    explicit BatchRunner(unsigned threads = std::thread::hardware_concurrency());
+
+    std::vector<BatchResult> run(const std::vector<BatchJob>& jobs);
+    static BatchSummary summarize(const std::vector<BatchResult>& results);
+
+    unsigned getThreads() const;
+    // Wall-clock time and ticks simulated by the last run
+    double getSeconds() const;
+    long long getTicks() const;
+
+private:
+    ThreadPool pool;
+    double seconds;
+    long long ticks;
 };
 
 #endif
\ No newline at end of file
@@ -1,7 +1,46 @@
 #include "game.hpp"
+#include <chrono>
 
-int main() {
-    Game game;
+// Plays a recording back headless at full speed and reports how long it took
+static int replay(const std::string& filename) {
+    ReplayInput input;
+    if (!input.load(filename)) return 1;
+
+    Logger::instance().setLevel(LogWarning);
+    Game game(true, input.getLevel());
+    game.setViewSize(input.getViewSize());
+    game.setDeterministic(true);
+    game.setInput(&input);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned ticks = 0;
+    while (!input.finished()) {
+        game.tick(Game::tickLength);
+        ticks++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    char hash[32];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(game.stateHash()));
+    std::cout << "Replayed " << ticks << " ticks in " << elapsed.count() << " s ("
+              << static_cast<long long>(ticks / elapsed.count()) << " ticks/s), final state " << hash << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string recordFile;
+    for (int i = 1; i + 1 < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--replay") return replay(argv[i + 1]);
+        if (option == "--record") recordFile = argv[++i];
+    }
+
+    const std::string level = "levels/level1";
+    Game game(false, level);
+    InputRecorder recorder(level);
+    if (!recordFile.empty()) game.setRecorder(&recorder);
     game.run();
+
+    if (!recordFile.empty()) recorder.save(recordFile, game.getViewSize());
     return 0;
 }
@@ -0,0 +1,28 @@
+#include "game.hpp"
+
+// Offline tool for baking game data.
+//
+//   packer [atlas.bin]                    bakes every frame listed in
+//                                         atlasSources into a pre-decoded atlas
+//   packer level <level.txt> <level.lvl>  compiles a text level for the game
+//                                         to map in place
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "level") {
+        if (argc < 4) {
+            std::cout << "Usage: packer level <level.txt> <level.lvl>" << std::endl;
+            return 1;
+        }
+        if (!Level::compile(argv[2], argv[3])) {
+            std::cout << "Failed to compile level: " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::string output = (argc > 1) ? argv[1] : AssetManager::atlasFile;
+    if (!AssetManager::packAtlas(output)) {
+        std::cout << "Failed to pack atlas: " << output << std::endl;
+        return 1;
+    }
+    return 0;
+}